@@ -16,6 +16,7 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <future>
 #include <stdexcept>
 
 #include <QDebug>
@@ -107,12 +108,20 @@ public:
         try {
             const auto& track
                 = m_song->track(m_settings.instrument, m_settings.difficulty);
+            std::future<Image> static_image;
             const auto builder = make_builder(
                 *m_song, track, m_settings,
                 [&](const QString& text) { emit write_text(text); },
-                &m_terminate);
+                &m_terminate, nullptr,
+                [&](const ImageBuilder& static_builder) {
+                    static_image = std::async(
+                        std::launch::async, [static_builder] {
+                            return Image::static_layers(static_builder);
+                        });
+                });
             emit write_text("Saving image...");
-            const Image image {builder};
+            auto image = static_image.get();
+            image.add_path_layers(builder);
             image.save(m_file_name.toStdString().c_str());
             emit write_text("Image saved");
             QDesktopServices::openUrl(QUrl::fromLocalFile(m_file_name));
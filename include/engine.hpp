@@ -20,6 +20,7 @@
 #define CHOPT_ENGINE_HPP
 
 #include <algorithm>
+#include <utility>
 
 #include <sightread/time.hpp>
 
@@ -173,16 +174,19 @@ public:
 };
 
 class FortniteGuitarEngine final : public BaseFortniteEngine {
+public:
     int max_multiplier() const override { return 4; };
     int sust_points_per_beat() const override { return 12; };
 };
 
 class FortniteBassEngine final : public BaseFortniteEngine {
+public:
     int max_multiplier() const override { return 6; };
     int sust_points_per_beat() const override { return 12; };
 };
 
 class FortniteVocalsEngine final : public BaseFortniteEngine {
+public:
     int max_multiplier() const override { return 6; };
     int sust_points_per_beat() const override { return 25; };
 };
@@ -302,4 +306,30 @@ public:
     int max_multiplier() const override { return 6; }
 };
 
+template <typename ConcreteEngine, typename... ConcreteEngines, typename F>
+decltype(auto) visit_engine_as(const Engine& engine, F&& f)
+{
+    if (const auto* concrete = dynamic_cast<const ConcreteEngine*>(&engine)) {
+        return f(*concrete);
+    }
+    if constexpr (sizeof...(ConcreteEngines) == 0) {
+        return f(engine);
+    } else {
+        return visit_engine_as<ConcreteEngines...>(engine, std::forward<F>(f));
+    }
+}
+
+// Calls f with engine as a reference to its concrete type. Every engine is
+// final, so calls to engine methods inside f are resolved at compile time and
+// can be inlined. Engines not listed here are passed through as an Engine.
+template <typename F> decltype(auto) visit_engine(const Engine& engine, F&& f)
+{
+    return visit_engine_as<ChGuitarEngine, ChPrecisionGuitarEngine,
+                           ChDrumEngine, ChPrecisionDrumEngine,
+                           FortniteGuitarEngine, FortniteBassEngine,
+                           FortniteVocalsEngine, Gh1Engine, RbEngine,
+                           RbBassEngine, Rb3Engine, Rb3BassEngine>(
+        engine, std::forward<F>(f));
+}
+
 #endif
@@ -0,0 +1,53 @@
+/*
+ * CHOpt - Star Power optimiser for Clone Hero
+ * Copyright (C) 2024 Raymond Wright
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef CHOPT_FINGERPRINT_HPP
+#define CHOPT_FINGERPRINT_HPP
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Builds a 64-bit FNV-1a hash of the values a result depends on, so that saved
+// results can be checked against the song and settings they came from. Values
+// are hashed by their bytes, so the hash is only stable on one platform.
+class Fingerprint {
+private:
+    static constexpr std::uint64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;
+    static constexpr std::uint64_t FNV_PRIME = 1099511628211ULL;
+
+    std::uint64_t m_hash {FNV_OFFSET_BASIS};
+
+public:
+    template <typename T> void add(T value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+
+        std::array<unsigned char, sizeof(T)> bytes {};
+        std::memcpy(bytes.data(), &value, sizeof(T));
+        for (auto byte : bytes) {
+            m_hash ^= byte;
+            m_hash *= FNV_PRIME;
+        }
+    }
+
+    [[nodiscard]] std::uint64_t value() const { return m_hash; }
+};
+
+#endif
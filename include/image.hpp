@@ -29,14 +29,23 @@ class Image {
 private:
     std::unique_ptr<ImageImpl> m_impl;
 
+    explicit Image(std::unique_ptr<ImageImpl> impl);
+
 public:
     explicit Image(const ImageBuilder& builder);
+    // Draws the parts of the image that do not depend on the path: the
+    // measures, notes, BPMs, time signatures and section markers. This can be
+    // done while the path is still being optimised.
+    [[nodiscard]] static Image static_layers(const ImageBuilder& builder);
     ~Image();
     Image(const Image&) = delete;
     Image(Image&& image) noexcept;
     Image& operator=(const Image&) = delete;
     Image& operator=(Image&& image) noexcept;
 
+    // Draws the header, score totals, SP phrases and activations over an image
+    // from static_layers.
+    void add_path_layers(const ImageBuilder& builder);
     void save(const char* filename) const;
 };
 
@@ -21,6 +21,7 @@
 
 #include <atomic>
 #include <functional>
+#include <memory>
 #include <string>
 #include <tuple>
 #include <vector>
@@ -31,6 +32,7 @@
 #include <sightread/tempomap.hpp>
 
 #include "engine.hpp"
+#include "optimiser.hpp"
 #include "points.hpp"
 #include "processed.hpp"
 #include "sp.hpp"
@@ -93,8 +95,14 @@ public:
                  const SightRead::DrumSettings& drum_settings,
                  bool is_lefty_flip, bool is_overlap_engine);
     void add_bpms(const SightRead::TempoMap& tempo_map);
+    // Adds the range of the Big Rock Ending. It is drawn with the static
+    // layers, so it does not need the scores.
     void add_bre(const SightRead::BigRockEnding& bre,
                  const SightRead::TempoMap& tempo_map);
+    // Adds the Big Rock Ending bonus to the total score and the last measure's
+    // score, so it must come after add_measure_values and set_total_score.
+    void add_bre_bonus(const SightRead::BigRockEnding& bre,
+                       const SightRead::TempoMap& tempo_map);
     void add_drum_fills(const SightRead::NoteTrack& track);
     void add_measure_values(const PointSet& points,
                             const SightRead::TempoMap& tempo_map,
@@ -225,10 +233,31 @@ public:
     [[nodiscard]] bool is_lefty_flip() const { return m_is_lefty_flip; }
 };
 
+// What make_builder keeps from one run to the next in watch mode. The next
+// run on an edited version of the chart reuses the optimiser's memo for the
+// part of the chart the edits do not affect.
+struct WatchState {
+    std::unique_ptr<const ProcessedSong> processed_song;
+    std::unique_ptr<Optimiser> optimiser;
+};
+
 ImageBuilder make_builder(SightRead::Song& song,
                           const SightRead::NoteTrack& track,
                           const Settings& settings,
                           const std::function<void(const char*)>& write,
-                          const std::atomic<bool>* terminate);
+                          const std::atomic<bool>* terminate,
+                          WatchState* watch_state = nullptr,
+                          const std::function<void(const ImageBuilder&)>&
+                              on_static_layers
+                          = {});
+
+// Optimises the track and writes the path summary without building any of the
+// image, for when no image is wanted.
+void write_path_summary(SightRead::Song& song,
+                        const SightRead::NoteTrack& track,
+                        const Settings& settings,
+                        const std::function<void(const char*)>& write,
+                        const std::atomic<bool>* terminate,
+                        WatchState* watch_state = nullptr);
 
 #endif
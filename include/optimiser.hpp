@@ -19,11 +19,21 @@
 #ifndef CHOPT_OPTIMISER_HPP
 #define CHOPT_OPTIMISER_HPP
 
+#include <algorithm>
 #include <atomic>
+#include <bit>
 #include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <iosfwd>
+#include <iterator>
 #include <limits>
 #include <map>
 #include <optional>
+#include <string>
 #include <tuple>
 #include <vector>
 
@@ -55,33 +65,152 @@ private:
         }
     };
 
+    // possible_next_acts holds at most MAX_STORED_TIES activations for keys in
+    // Cache.paths. If more tie for the best score, only those that
+    // optimal_path could prefer are kept and ties_truncated is set.
+    //
+    // If source is set, the activations were taken from the entry for source
+    // by try_previous_best_subpaths. If is_evicted is set, possible_next_acts
+    // has been freed to keep within the memory budget, and is worked out again
+    // by recompute_acts when it is needed.
+    //
+    // An entry in Cache.paths also holds for every key at the same point with
+    // a position from the entry's up to valid_until: the best score from those
+    // keys is the same, and their activations are worked out from the entry's
+    // by cached_acts.
     struct CacheValue {
         std::vector<std::tuple<ProtoActivation, CacheKey>> possible_next_acts;
         int score_boost;
+        bool ties_truncated {false};
+        std::optional<CacheKey> source {};
+        bool is_evicted {false};
+        SightRead::Beat valid_until {NEG_INF};
     };
 
+    // A valid activation found while searching for the best subpaths from a
+    // key, together with the key the rest of the path starts from.
+    struct SubpathCandidate {
+        ProtoActivation act;
+        CacheKey next_key;
+        int act_score;
+    };
+
+    // Everything find_best_subpaths needs to know about a key except the
+    // scores of later keys. If full_sp_point is set, the search stopped there
+    // because the rest of the path starts with full SP at that point.
+    struct PendingSubpaths {
+        std::vector<SubpathCandidate> candidates;
+        std::optional<PointPtr> full_sp_point;
+    };
+
+    // While a search is checkpointing, each entry is serialised into
+    // unsaved_entries as it is cached. Every checkpoint interval they are
+    // handed to a background write, so the search does not wait on the disk.
+    struct CheckpointState {
+        std::string unsaved_entries;
+        std::chrono::steady_clock::time_point next_write;
+        std::future<void> pending_write;
+    };
+
+    // memo_bytes is an estimate of the memory used by paths and
+    // full_sp_paths, and kept_bytes is the part of it that is never freed:
+    // every entry's key and score, and the activations of full SP entries.
+    // evictable_keys holds the keys of the entries in paths whose activations
+    // are still held, oldest first.
     struct Cache {
         std::map<CacheKey, CacheValue> paths;
         std::map<PointPtr, CacheValue> full_sp_paths;
+        std::optional<CheckpointState> checkpoint;
+        std::size_t memo_bytes {0};
+        std::size_t kept_bytes {0};
+        std::deque<CacheKey> evictable_keys;
+    };
+
+    // An activation picked for the final path, with the key it was picked
+    // from and its squeeze level from that key. initial_sp is the SP already
+    // in the bar at the key, which is only set for the first activation of a
+    // path from best_path_from.
+    struct ChosenAct {
+        ProtoActivation act;
+        CacheKey key;
+        double sqz_level;
+        double initial_sp {0.0};
+    };
+
+    // An activation of a path for best_paths, linked to the activation before
+    // it, so that paths which start the same way share their start.
+    struct AlternativeNode {
+        ChosenAct act;
+        std::optional<std::size_t> parent;
+    };
+
+    // A path for best_paths to finish: the activations up to last_node are
+    // followed by the best path from key, and score is the score of the whole
+    // path. If full_sp_point is set, it instead stands for every path that
+    // swaps in an activation from the full SP searches at full_sp_point and
+    // after, from key, and score is the best score of those paths.
+    struct AlternativePath {
+        int score;
+        std::optional<std::size_t> last_node;
+        CacheKey key;
+        std::optional<PointPtr> full_sp_point;
+    };
+
+    // An activation taken by greedy_steps, with the key it was taken from.
+    struct GreedyStep {
+        CacheKey key;
+        SubpathCandidate candidate;
+    };
+
+    using Deadline = std::optional<std::chrono::steady_clock::time_point>;
+    // The results of find_best_subpaths for full SP keys, by point.
+    using FullSpSearches = std::map<PointPtr, PendingSubpaths>;
+
+    // A key whose best subpaths are being worked out by get_partial_path.
+    // pending is empty until the candidates have been searched for.
+    struct PathFrame {
+        CacheKey key;
+        bool has_full_sp;
+        std::optional<PendingSubpaths> pending;
     };
 
     // The idea is this is like a std::set<PointPtr>, but is add-only and takes
     // advantage of the fact that we often tend to add all elements before a
-    // certain point.
+    // certain point. Elements are stored as a bitset over [start, end), so
+    // that the lowest absent element can be found a word at a time. reset
+    // clears only the words that were used, so one set can be reused for many
+    // ranges without allocating.
     class PointPtrRangeSet {
     private:
+        static constexpr std::size_t WORD_BITS = 64;
+
         PointPtr m_start;
         PointPtr m_end;
-        PointPtr m_min_absent_ptr;
-        std::vector<PointPtr> m_abnormal_elements;
+        std::size_t m_min_absent_index {0};
+        std::size_t m_used_words {0};
+        std::vector<std::uint64_t> m_words;
+
+        [[nodiscard]] std::size_t index(PointPtr element) const
+        {
+            return static_cast<std::size_t>(std::distance(m_start, element));
+        }
 
     public:
-        PointPtrRangeSet(PointPtr start, PointPtr end)
-            : m_start {start}
-            , m_end {end}
-            , m_min_absent_ptr {start}
+        void reset(PointPtr start, PointPtr end)
         {
             assert(start < end); // NOLINT
+            std::fill_n(m_words.begin(), m_used_words, 0);
+            m_used_words = 0;
+            const auto word_count
+                = (static_cast<std::size_t>(std::distance(start, end))
+                   + WORD_BITS - 1)
+                / WORD_BITS;
+            if (m_words.size() < word_count) {
+                m_words.resize(word_count, 0);
+            }
+            m_start = start;
+            m_end = end;
+            m_min_absent_index = 0;
         }
 
         [[nodiscard]] bool contains(PointPtr element) const
@@ -89,81 +218,225 @@ private:
             if (m_start > element || m_end <= element) {
                 return false;
             }
-            if (element < m_min_absent_ptr) {
-                return true;
-            }
-            return std::find(m_abnormal_elements.cbegin(),
-                             m_abnormal_elements.cend(), element)
-                != m_abnormal_elements.cend();
+            const auto i = index(element);
+            return ((m_words[i / WORD_BITS] >> (i % WORD_BITS)) & 1U) != 0;
         }
 
         [[nodiscard]] PointPtr lowest_absent_element() const
         {
-            return m_min_absent_ptr;
+            return std::next(
+                m_start,
+                static_cast<std::iter_difference_t<PointPtr>>(
+                    m_min_absent_index));
         }
 
         void add(PointPtr element)
         {
             assert(m_start <= element); // NOLINT
             assert(element < m_end); // NOLINT
-            if (m_min_absent_ptr == element) {
-                ++m_min_absent_ptr;
-                while (true) {
-                    auto next_elem_iter = std::find(m_abnormal_elements.begin(),
-                                                    m_abnormal_elements.end(),
-                                                    m_min_absent_ptr);
-                    if (next_elem_iter == m_abnormal_elements.end()) {
-                        return;
-                    }
-                    std::swap(*next_elem_iter, m_abnormal_elements.back());
-                    m_abnormal_elements.pop_back();
-                    ++m_min_absent_ptr;
+            const auto i = index(element);
+            const auto word = i / WORD_BITS;
+            m_words[word] |= std::uint64_t {1} << (i % WORD_BITS);
+            m_used_words = std::max(m_used_words, word + 1);
+            if (i != m_min_absent_index) {
+                return;
+            }
+            // Skip the run of present elements starting at the old lowest
+            // absent one. Bits past m_end are never set, so this stops there
+            // at the latest.
+            while (m_min_absent_index / WORD_BITS < m_words.size()) {
+                const auto offset = m_min_absent_index % WORD_BITS;
+                const auto run = static_cast<std::size_t>(std::countr_one(
+                    m_words[m_min_absent_index / WORD_BITS] >> offset));
+                m_min_absent_index += run;
+                if (offset + run < WORD_BITS) {
+                    return;
                 }
-            } else {
-                m_abnormal_elements.push_back(element);
             }
         }
     };
 
     static constexpr double NEG_INF = -std::numeric_limits<double>::infinity();
     static constexpr double BASE_DRUM_FILL_DELAY = 2.0 * 100;
+    static constexpr std::size_t MAX_STORED_TIES = 16;
+    // Starting a thread takes about 25us, against 3-7us to work out a
+    // squeeze level and 5-19us to build an activation, so work is only split
+    // across threads when each task gets enough of it to pay for its thread.
+    static constexpr std::size_t MIN_TIES_PER_TASK = 16;
+    static constexpr std::size_t MIN_ACTS_PER_TASK = 8;
+    // act_squeeze_level bisects down to an interval of SQZ_THRESHOLD, so
+    // MIN_SQZ_LEVEL is the lowest level it can return.
+    static constexpr double SQZ_THRESHOLD = 0.01;
+    static constexpr double MIN_SQZ_LEVEL = [] {
+        auto level = 1.0;
+        while (level > SQZ_THRESHOLD) {
+            level /= 2;
+        }
+        return level;
+    }();
     const ProcessedSong* m_song;
     const std::atomic<bool>* m_terminate;
     const SightRead::Second m_drum_fill_delay;
     SightRead::Second m_whammy_delay;
-    std::vector<PointPtr> m_next_candidate_points;
+    std::vector<std::uint32_t> m_next_candidate_points;
+    // m_act_end_limits[i] is the index of the first point from which on no
+    // activation starting at point i can end, even with a full bar, every
+    // phrase and all the whammy along the way.
+    std::vector<std::uint32_t> m_act_end_limits;
+    std::string m_checkpoint_path;
+    SightRead::Second m_checkpoint_interval {0.0};
+    std::optional<std::size_t> m_max_memory;
+    // The memo of every search, kept for as long as the optimiser so that
+    // later searches and queries only work out what it is missing.
+    Cache m_memo;
+    mutable std::atomic<std::size_t> m_evictions {0};
+    mutable std::atomic<std::size_t> m_recomputations {0};
+    mutable std::atomic<std::size_t> m_peak_memo_bytes {0};
+    mutable std::atomic<std::size_t> m_kept_memo_bytes {0};
+    mutable std::atomic<std::size_t> m_searched_keys {0};
 
     [[nodiscard]] PointPtr next_candidate_point(PointPtr point) const;
     [[nodiscard]] CacheKey advance_cache_key(CacheKey key) const;
     [[nodiscard]] CacheKey add_whammy_delay(CacheKey key) const;
+    [[nodiscard]] std::vector<std::tuple<ProtoActivation, CacheKey>>
+    acts_still_possible(
+        const std::vector<std::tuple<ProtoActivation, CacheKey>>& acts,
+        CacheKey key) const;
     [[nodiscard]] std::optional<CacheValue>
     try_previous_best_subpaths(CacheKey key, const Cache& cache,
                                bool has_full_sp) const;
-    CacheValue find_best_subpaths(CacheKey key, Cache& cache,
-                                  bool has_full_sp) const;
-    int get_partial_path(CacheKey key, Cache& cache) const;
-    int get_partial_full_sp_path(PointPtr point, Cache& cache) const;
-    [[nodiscard]] double act_squeeze_level(ProtoActivation act,
-                                           CacheKey key) const;
+    [[nodiscard]] PendingSubpaths
+    find_best_subpaths(CacheKey key, bool has_full_sp,
+                       double initial_sp = 0.0) const;
+    [[nodiscard]] std::vector<SubpathCandidate>
+    step_candidates(CacheKey key, FullSpSearches& full_sp_searches) const;
+    [[nodiscard]] std::vector<GreedyStep> greedy_steps(CacheKey key) const;
+    [[nodiscard]] CacheValue
+    resolve_subpaths(const PendingSubpaths& pending, const Cache& cache) const;
+    void bound_ties(CacheValue& value, CacheKey key) const;
+    [[nodiscard]] static std::map<CacheKey, CacheValue>::const_iterator
+    covering_entry(CacheKey key, const Cache& cache);
+    [[nodiscard]] static bool is_cached(const PathFrame& frame,
+                                        const Cache& cache);
+    void push_uncached_dependencies(const PendingSubpaths& pending,
+                                    const Cache& cache,
+                                    std::vector<PathFrame>& frames) const;
+    bool get_partial_path(CacheKey key, Cache& cache,
+                          Deadline deadline = std::nullopt,
+                          bool has_full_sp = false) const;
+    [[nodiscard]] static std::size_t acts_bytes(const CacheValue& value);
+    void add_path_to_cache(CacheKey key, CacheValue value, Cache& cache) const;
+    void add_to_cache(CacheKey key, bool has_full_sp, CacheValue value,
+                      Cache& cache) const;
+    void evict_entries(Cache& cache) const;
+    [[nodiscard]] std::vector<std::tuple<ProtoActivation, CacheKey>>
+    recompute_acts(CacheKey key, const Cache& cache) const;
+    [[nodiscard]] CacheKey initial_key() const;
+    CacheKey solve(Cache& cache) const;
+    [[nodiscard]] int cached_score(CacheKey key, Cache& cache) const;
+    [[nodiscard]] int full_sp_score(PointPtr point, Cache& cache) const;
+    [[nodiscard]] std::uint64_t checkpoint_fingerprint() const;
+    void write_checkpoint_key(std::string& buffer, CacheKey key) const;
+    [[nodiscard]] std::optional<CacheKey>
+    read_checkpoint_key(std::istream& stream) const;
+    [[nodiscard]] std::size_t read_checkpoint(Cache& cache) const;
+    void open_checkpoint(Cache& cache) const;
+    void save_to_checkpoint(CacheKey key, bool has_full_sp,
+                            const CacheValue& value, Cache& cache) const;
+    void save_valid_until_to_checkpoint(CacheKey key,
+                                        SightRead::Beat valid_until,
+                                        Cache& cache) const;
+    void close_checkpoint(Cache& cache) const;
+    [[nodiscard]] CacheValue resolve_from(CacheKey key, Cache& cache,
+                                          double initial_sp = 0.0) const;
+    [[nodiscard]] std::vector<std::tuple<ProtoActivation, CacheKey>>
+    cached_acts(CacheKey key, Cache& cache) const;
+    void choose_cached_acts(CacheKey key, Cache& cache,
+                            std::vector<ChosenAct>& chosen_acts) const;
+    [[nodiscard]] std::vector<Activation>
+    build_activations(const std::vector<ChosenAct>& chosen_acts) const;
+    [[nodiscard]] ActResult
+    squeezed_act_result(ProtoActivation act, CacheKey key, double sqz_level,
+                        double initial_sp = 0.0) const;
+    [[nodiscard]] double
+    act_squeeze_level(ProtoActivation act, CacheKey key,
+                      double cutoff = std::numeric_limits<double>::infinity(),
+                      double initial_sp = 0.0) const;
+    [[nodiscard]] std::tuple<std::size_t, double> best_tie(
+        const std::vector<std::tuple<ProtoActivation, CacheKey>>& acts,
+        CacheKey key, double initial_sp = 0.0) const;
+    [[nodiscard]] Activation
+    build_activation(const ChosenAct& chosen_act) const;
     [[nodiscard]] SpPosition forced_whammy_end(ProtoActivation act,
-                                               CacheKey key,
-                                               double sqz_level) const;
+                                               CacheKey key, double sqz_level,
+                                               double initial_sp) const;
     [[nodiscard]] std::tuple<SightRead::Beat, SightRead::Beat>
     act_duration(ProtoActivation act, CacheKey key, double sqz_level,
-                 SpPosition min_whammy_force) const;
+                 SpPosition min_whammy_force, double initial_sp) const;
     [[nodiscard]] SightRead::Second
     earliest_fill_appearance(CacheKey key, bool has_full_sp) const;
-    void complete_subpath(
-        PointPtr p, SpPosition starting_pos, SpBar sp_bar,
-        PointPtrRangeSet& attained_act_ends, Cache& cache,
-        int& best_score_boost,
-        std::vector<std::tuple<ProtoActivation, CacheKey>>& acts) const;
+    void complete_subpath(PointPtr p, SpPosition starting_pos, SpBar sp_bar,
+                          PointPtrRangeSet& attained_act_ends,
+                          std::vector<SubpathCandidate>& candidates) const;
 
 public:
+    // The result of best_path_within. is_optimal is set if the search
+    // finished in time, in which case path is the same as optimal_path's.
+    struct AnytimePath {
+        Path path;
+        bool is_optimal;
+    };
+
+    // The number of memo entries evicted to keep within the memory budget,
+    // the number of times an evicted entry was worked out again, the largest
+    // estimated size of the memo, how much of the memo could never be freed,
+    // and the number of keys the searches have had to search.
+    struct CacheStats {
+        std::size_t evictions;
+        std::size_t recomputations;
+        std::size_t peak_memo_bytes;
+        std::size_t kept_memo_bytes;
+        std::size_t searched_keys;
+    };
+
     Optimiser(const ProcessedSong* song, const std::atomic<bool>* terminate,
               int speed, SightRead::Second whammy_delay);
+    // Saves search results to path as they are found, writing them out at
+    // least every interval, and resumes from path if it holds results for the
+    // same song and settings.
+    void set_checkpoint(std::string path, SightRead::Second interval);
+    // Limits the memory used by the memo to about max_bytes. Past that, the
+    // activations stored for the oldest keys are freed and worked out again
+    // if needed; the paths found are unchanged. Keys and scores are never
+    // freed, so the memo goes over max_bytes if they alone need more.
+    void set_max_memory(std::size_t max_bytes);
+    [[nodiscard]] CacheStats cache_stats() const;
+    // Carries over the memo entries previous kept for an earlier version of
+    // the same chart with the same settings, for the points at the end of the
+    // song the edits since then cannot affect. The next search only works out
+    // the rest. Returns the number of entries carried over; previous's song
+    // must still be alive.
+    std::size_t reuse_memo(const Optimiser& previous);
+    // The queries below all add to the same memo, so only one can run at a
+    // time on an Optimiser.
     // Return the optimal Star Power path.
-    [[nodiscard]] Path optimal_path() const;
+    [[nodiscard]] Path optimal_path();
+    // Return up to count Star Power paths with distinct activations, best
+    // first, so the first is the optimal path. The others are read off the
+    // memo of the same search, so they cost far less than the search itself.
+    [[nodiscard]] std::vector<Path> best_paths(std::size_t count);
+    // Return the best path for the rest of the song from a point in the
+    // middle of it: point_index is the index of the next point to be hit, and
+    // the bar holds sp, with SP gained from position on. The full search only
+    // runs if no search has yet: queries after optimal_path, best_paths or
+    // another query reuse the memo, so they only work out what it is missing.
+    [[nodiscard]] Path best_path_from(std::size_t point_index, double sp,
+                                      SpPosition position);
+    // Return the best Star Power path that can be found within time_limit. A
+    // quick greedy path is found first, then the full search runs until the
+    // time is up; the result is the greedy path up to the first key the search
+    // has finished with, followed by the best path from that key.
+    [[nodiscard]] AnytimePath best_path_within(SightRead::Second time_limit);
 };
 
 #endif
@@ -19,6 +19,9 @@
 #ifndef CHOPT_POINTS_HPP
 #define CHOPT_POINTS_HPP
 
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
 #include <limits>
 #include <optional>
 #include <string>
@@ -34,11 +37,16 @@
 #include "sptimemap.hpp"
 
 // fill_start is used for Drums, giving the start of the fill that makes a point
-// an activation note if it is one, or nullopt otherwise.
+// an activation note if it is one, or nullopt otherwise. The *_seconds members
+// are the same times as position, hit_window_start and hit_window_end, kept so
+// squeezed hit windows can be found without converting back from beats.
 struct Point {
     SpPosition position;
     SpPosition hit_window_start;
     SpPosition hit_window_end;
+    SightRead::Second position_seconds;
+    SightRead::Second hit_window_start_seconds;
+    SightRead::Second hit_window_end_seconds;
     std::optional<SightRead::Second> fill_start;
     int value;
     int base_value;
@@ -49,16 +57,26 @@ struct Point {
 
 using PointPtr = std::vector<Point>::const_iterator;
 
+// The per-point lookup tables hold indices into m_points rather than
+// iterators, and colour sets are stored as ids into m_colour_names, since most
+// points share one of a handful of colour sets.
 class PointSet {
 private:
     std::vector<Point> m_points;
-    std::vector<PointPtr> m_first_after_current_sp;
-    std::vector<PointPtr> m_next_non_hold_point;
-    std::vector<PointPtr> m_next_sp_granting_note;
+    std::vector<std::uint32_t> m_first_after_current_sp;
+    std::vector<std::uint32_t> m_next_non_hold_point;
+    std::vector<std::uint32_t> m_next_sp_granting_note;
+    std::vector<std::uint32_t> m_next_fill_point;
     std::vector<std::tuple<SpPosition, int>> m_solo_boosts;
     std::vector<int> m_cumulative_score_totals;
     SightRead::Second m_video_lag;
-    std::vector<std::string> m_colours;
+    std::vector<std::string> m_colour_names;
+    std::vector<std::uint16_t> m_colour_ids;
+
+    [[nodiscard]] std::size_t index_of(PointPtr point) const
+    {
+        return static_cast<std::size_t>(std::distance(m_points.cbegin(), point));
+    }
 
 public:
     PointSet(const SightRead::NoteTrack& track, const SpTimeMap& time_map,
@@ -74,10 +92,18 @@ public:
     [[nodiscard]] PointPtr first_after_current_phrase(PointPtr point) const;
     [[nodiscard]] PointPtr next_non_hold_point(PointPtr point) const;
     [[nodiscard]] PointPtr next_sp_granting_note(PointPtr point) const;
-    [[nodiscard]] std::string colour_set(PointPtr point) const
+    // Returns the first point from point onwards with a fill_start, i.e., that
+    // a drum activation can start on.
+    [[nodiscard]] PointPtr next_fill_point(PointPtr point) const;
+    // Points with the same colour set have the same id, so ids can be compared
+    // in place of the strings.
+    [[nodiscard]] std::uint16_t colour_set_id(PointPtr point) const
+    {
+        return m_colour_ids[index_of(point)];
+    }
+    [[nodiscard]] const std::string& colour_set(PointPtr point) const
     {
-        return m_colours[static_cast<std::size_t>(
-            std::distance(m_points.cbegin(), point))];
+        return m_colour_names[colour_set_id(point)];
     }
     // Get the combined score of all points that are >= start and < end.
     [[nodiscard]] int range_score(PointPtr start, PointPtr end) const;
@@ -19,6 +19,7 @@
 #ifndef CHOPT_PROCESSED_HPP
 #define CHOPT_PROCESSED_HPP
 
+#include <cstdint>
 #include <limits>
 #include <numeric>
 #include <string>
@@ -30,6 +31,7 @@
 #include <sightread/tempomap.hpp>
 #include <sightread/time.hpp>
 
+#include "fingerprint.hpp"
 #include "points.hpp"
 #include "settings.hpp"
 #include "sp.hpp"
@@ -62,9 +64,15 @@ enum class ActValidity { success, insufficient_sp, surplus_sp };
 
 // Return value of ProcessedSong::is_candidate_valid, providing information on
 // whether an activation is valid, and if so the earliest position it can end.
+// sp_margin is how much SP, in bars, the activation has to spare before it
+// stops being valid: the least SP left in the bar along the latest way
+// through, or how far short of the next point the earliest end is. It is
+// negative when the activation fails, and piecewise linear in the positions
+// and squeeze it is checked at, so solvers can interpolate on it.
 struct ActResult {
     SpPosition ending_position;
     ActValidity validity;
+    double sp_margin {0.0};
 };
 
 struct Path {
@@ -96,6 +104,13 @@ private:
     void append_activation(std::stringstream& stream,
                            const Activation& activation,
                            const std::string& act_summary) const;
+    // is_candidate_valid dispatches to this once on m_overlaps, so the loop
+    // over SP granting notes does not test it.
+    template <bool Overlaps>
+    [[nodiscard]] ActResult
+    is_candidate_valid_impl(const ActivationCandidate& activation,
+                            double squeeze,
+                            SpPosition required_whammy_end) const;
 
     // This static function is necessary to deal with a bug in MSVC. See
     // https://developercommunity.visualstudio.com/t/ICE-with-MSVC-1940-with-default-functio/10750601
@@ -117,12 +132,14 @@ public:
     // points. Does not include SP from the point act_start. first_point is
     // given for the purposes of counting SP grantings notes, e.g. if start is
     // after the middle of first_point's timing window. All whammy up to
-    // required_whammy_end is mandatory.
+    // required_whammy_end is mandatory. initial_sp is the SP already in the
+    // bar at start.
     [[nodiscard]] SpBar total_available_sp(SightRead::Beat start,
                                            PointPtr first_point,
                                            PointPtr act_start,
                                            SightRead::Beat required_whammy_end
-                                           = SightRead::Beat {NEG_INF}) const;
+                                           = SightRead::Beat {NEG_INF},
+                                           double initial_sp = 0.0) const;
     // Similar to total_available_sp, but no whammy is required and if it is
     // possible to get a half bar then the earliest position >=
     // earliest_potential_pos that grants a half bar is returned along with the
@@ -130,7 +147,7 @@ public:
     [[nodiscard]] std::tuple<SpBar, SpPosition>
     total_available_sp_with_earliest_pos(
         SightRead::Beat start, PointPtr first_point, PointPtr act_start,
-        SpPosition earliest_potential_pos) const;
+        SpPosition earliest_potential_pos, double initial_sp = 0.0) const;
     // Returns an ActResult which says if an activation is valid, and if so the
     // earliest position it can end. Checks squeezes against the given amount
     // only.
@@ -139,6 +156,17 @@ public:
         SpPosition required_whammy_end = default_position()) const;
     // Return the summary of a path.
     [[nodiscard]] std::string path_summary(const Path& path) const;
+    // Adds everything optimisation results depend on to fingerprint.
+    void add_to_fingerprint(Fingerprint& fingerprint) const;
+    // Return the number of points at the end of the song from which on
+    // optimisation results are the same as for the points at the end of
+    // other, such as after an edit earlier in the chart.
+    [[nodiscard]] std::size_t
+    common_suffix_length(const ProcessedSong& other) const;
+    // Return, for each point, the index of the first point from which on no
+    // activation starting at that point can end, even with a full bar, every
+    // phrase and all the whammy along the way.
+    [[nodiscard]] std::vector<std::uint32_t> act_end_limits() const;
 
     // Return the position that is (100 - squeeze)% along the start of point's
     // timing window.
@@ -153,6 +181,7 @@ public:
     [[nodiscard]] const SpData& sp_data() const { return m_sp_data; }
     [[nodiscard]] const SpTimeMap& sp_time_map() const { return m_time_map; }
     [[nodiscard]] bool is_drums() const { return m_is_drums; }
+    [[nodiscard]] bool overlaps() const { return m_overlaps; }
     [[nodiscard]] double minimum_sp_to_activate() const
     {
         return m_minimum_sp_to_activate;
@@ -19,7 +19,9 @@
 #ifndef CHOPT_SETTINGS_HPP
 #define CHOPT_SETTINGS_HPP
 
+#include <cstddef>
 #include <memory>
+#include <optional>
 #include <set>
 #include <string>
 
@@ -75,6 +77,21 @@ struct Settings {
     std::unique_ptr<Engine> engine;
     SightRead::DrumSettings drum_settings;
     float opacity;
+    // If set, the optimiser returns the best path it has found once this much
+    // time has passed, even if it is not yet known to be optimal.
+    std::optional<SightRead::Second> time_limit;
+    // If non-empty, the optimiser saves its progress to this file every
+    // checkpoint_interval, and resumes from it if it was saved for the same
+    // song and settings.
+    std::string checkpoint_path;
+    SightRead::Second checkpoint_interval {60.0};
+    // If set, the optimiser keeps its memo to about this many bytes, working
+    // out evicted results again when needed.
+    std::optional<std::size_t> max_memory;
+    // The number of next best paths to summarise after the optimal path.
+    std::size_t alternatives {0};
+    // If set, the chart is optimised again each time the file is saved.
+    bool watch {false};
 };
 
 // Parses the command line options.
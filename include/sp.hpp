@@ -20,6 +20,8 @@
 #define CHOPT_SP_HPP
 
 #include <algorithm>
+#include <cstddef>
+#include <cstdint>
 #include <limits>
 #include <tuple>
 #include <vector>
@@ -29,6 +31,7 @@
 #include <sightread/time.hpp>
 
 #include "engine.hpp"
+#include "fingerprint.hpp"
 #include "settings.hpp"
 #include "sptimemap.hpp"
 
@@ -70,9 +73,12 @@ public:
 // This is used by the optimiser to calculate SP drain.
 class SpData {
 private:
+    // cumulative_sp_gain is the net SP gained from whammying from the first
+    // BeatRate up to position.
     struct BeatRate {
         SightRead::Beat position;
         double net_sp_gain_rate;
+        double cumulative_sp_gain {0.0};
     };
 
     struct WhammyRange {
@@ -81,21 +87,33 @@ private:
         SightRead::Beat note;
     };
 
-    struct WhammyPropagationState {
-        std::vector<BeatRate>::const_iterator current_beat_rate;
-        SightRead::Beat current_position;
-        double current_sp;
+    // Summarises the cumulative SP gain over a run of BeatRate positions.
+    // max_drop is the largest fall from one position to a later one; a fall of
+    // more than a full bar means SP runs out even if the bar was filled first.
+    struct SpGainSummary {
+        double max;
+        double min;
+        double max_drop;
     };
 
     static constexpr double DEFAULT_BEATS_PER_BAR = 32.0;
     static constexpr double MEASURES_PER_BAR = 8.0;
+    static constexpr double WHAMMY_BUCKETS_PER_RANGE = 4.0;
 
     SpTimeMap m_time_map;
     std::vector<BeatRate> m_beat_rates;
+    // Segment tree over m_beat_rates' cumulative_sp_gain, with the root at
+    // index 1 and the children of node i at 2i and 2i + 1.
+    std::vector<SpGainSummary> m_gain_tree;
     std::vector<WhammyRange> m_whammy_ranges;
     SightRead::Beat m_last_whammy_point {
         -std::numeric_limits<double>::infinity()};
-    std::vector<std::vector<WhammyRange>::const_iterator> m_initial_guesses;
+    // m_whammy_range_buckets[i] is the index of the first whammy range that
+    // ends after beat i * m_whammy_bucket_width. There are a fixed number of
+    // buckets per whammy range, so this scales with the number of sustains
+    // rather than the length of the song.
+    std::vector<std::uint32_t> m_whammy_range_buckets;
+    double m_whammy_bucket_width {1.0};
     const double m_sp_gain_rate;
     const double m_default_net_sp_gain_rate;
 
@@ -104,6 +122,19 @@ private:
                     const std::vector<SightRead::Tick>& od_beats,
                     const Engine& engine);
 
+    static SpGainSummary combine(const SpGainSummary& lhs,
+                                 const SpGainSummary& rhs);
+
+    void build_gain_tree(std::size_t node, std::size_t first, std::size_t last);
+    [[nodiscard]] SpGainSummary gain_summary(std::size_t node, std::size_t first,
+                                             std::size_t last, std::size_t lo,
+                                             std::size_t hi) const;
+    [[nodiscard]] std::size_t
+    first_sp_exhaustion(std::size_t node, std::size_t first, std::size_t last,
+                        std::size_t lo, std::size_t hi, double sp_floor,
+                        double& running_max) const;
+    [[nodiscard]] double cumulative_sp_gain(SightRead::Beat position) const;
+    [[nodiscard]] double net_sp_gain_rate_after(SightRead::Beat position) const;
     [[nodiscard]] double
     propagate_over_whammy_range(SightRead::Beat start, SightRead::Beat end,
                                 double sp_bar_amount) const;
@@ -112,9 +143,6 @@ private:
                                 double sp_bar_amount) const;
     [[nodiscard]] std::vector<WhammyRange>::const_iterator
     first_whammy_range_after(SightRead::Beat pos) const;
-    [[nodiscard]] WhammyPropagationState
-    initial_whammy_prop_state(SightRead::Beat start, SightRead::Beat end,
-                              double sp_bar_amount) const;
     SpPosition sp_drain_end_point(SpPosition start, double sp_bar_amount) const;
 
 public:
@@ -143,6 +171,17 @@ public:
     [[nodiscard]] double available_whammy(SightRead::Beat start,
                                           SightRead::Beat end,
                                           SightRead::Beat note_pos) const;
+    // Return the earliest beat up to which sp_amount of whammy is obtainable
+    // from start, from notes before note_pos, or end if it is not obtainable
+    // by end.
+    [[nodiscard]] SightRead::Beat
+    whammy_end_for_sp(SightRead::Beat start, SightRead::Beat end,
+                      SightRead::Beat note_pos, double sp_amount) const;
+    // Adds everything SP drain and whammy results depend on to fingerprint.
+    void add_to_fingerprint(Fingerprint& fingerprint) const;
+    // Return the beat from which on SP drain and whammy are the same as for
+    // other, or +inf if SP drains differently throughout.
+    [[nodiscard]] SightRead::Beat matches_from(const SpData& other) const;
     // Return how far an activation can propagate based on whammy, returning the
     // end of the range if it can be reached.
     [[nodiscard]] SpPosition activation_end_point(SpPosition start,
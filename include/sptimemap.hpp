@@ -23,6 +23,8 @@
 
 #include <sightread/tempomap.hpp>
 
+#include "fingerprint.hpp"
+
 class SpMeasure {
 private:
     double m_value;
@@ -113,6 +115,9 @@ public:
 
     [[nodiscard]] SpMeasure to_sp_measures(SightRead::Beat beats) const;
     [[nodiscard]] SpMeasure to_sp_measures(SightRead::Second seconds) const;
+
+    // Adds the tempos, time signatures, OD beats and SP mode to fingerprint.
+    void add_to_fingerprint(Fingerprint& fingerprint) const;
 };
 
 #endif
@@ -24,6 +24,7 @@
 #include <map>
 #include <set>
 #include <stdexcept>
+#include <utility>
 
 #include <QImage>
 #include <QString>
@@ -46,6 +47,8 @@ constexpr int MARGIN = 92;
 constexpr int MEASURE_HEIGHT = 61;
 constexpr int TOP_MARGIN = 125;
 constexpr int DIST_BETWEEN_MEASURES = MEASURE_HEIGHT + MARGIN;
+constexpr float RANGE_OPACITY = 0.33333F;
+constexpr int SOLO_HEIGHT = 10;
 
 namespace {
 const char* diff_to_str(SightRead::Difficulty difficulty)
@@ -558,51 +561,69 @@ void ImageImpl::draw_practice_sections(const ImageBuilder& builder)
 }
 
 Image::Image(const ImageBuilder& builder)
+    : Image {static_layers(builder)}
+{
+    add_path_layers(builder);
+}
+
+Image::Image(std::unique_ptr<ImageImpl> impl)
+    : m_impl {std::move(impl)}
+{
+}
+
+Image Image::static_layers(const ImageBuilder& builder)
 {
-    constexpr std::array<unsigned char, 3> green {0, 255, 0};
-    constexpr std::array<unsigned char, 3> blue {0, 0, 255};
-    constexpr std::array<unsigned char, 3> yellow {255, 255, 0};
-    constexpr std::array<unsigned char, 3> red {255, 0, 0};
     constexpr std::array<unsigned char, 3> solo_blue {0, 51, 128};
     constexpr std::array<unsigned char, 3> pink {127, 0, 0};
 
     constexpr unsigned int IMAGE_WIDTH = 1024;
-    constexpr float RANGE_OPACITY = 0.33333F;
-    constexpr int SOLO_HEIGHT = 10;
     constexpr unsigned char WHITE = 255;
 
     const auto height = static_cast<unsigned int>(
         TOP_MARGIN + MARGIN + DIST_BETWEEN_MEASURES * builder.rows().size());
 
-    m_impl = std::make_unique<ImageImpl>(IMAGE_WIDTH, height, 1, 3, WHITE);
-    m_impl->draw_version();
-    m_impl->draw_header(builder);
-    m_impl->draw_practice_sections(builder);
-    m_impl->draw_measures(builder);
-    m_impl->draw_tempos(builder);
-    m_impl->draw_time_sigs(builder);
+    auto impl = std::make_unique<ImageImpl>(IMAGE_WIDTH, height, 1, 3, WHITE);
+    impl->draw_version();
+    impl->draw_practice_sections(builder);
+    impl->draw_measures(builder);
+    impl->draw_tempos(builder);
+    impl->draw_time_sigs(builder);
 
     for (const auto& range : builder.solo_ranges()) {
-        m_impl->colour_beat_range(
+        impl->colour_beat_range(
             builder, solo_blue, range,
             {-SOLO_HEIGHT, MEASURE_HEIGHT - 1 + SOLO_HEIGHT},
             RANGE_OPACITY / 2);
     }
 
     for (const auto& range : builder.bre_ranges()) {
-        m_impl->colour_beat_range(
+        impl->colour_beat_range(
             builder, pink, range,
             {-SOLO_HEIGHT, MEASURE_HEIGHT - 1 + SOLO_HEIGHT},
             RANGE_OPACITY / 2);
     }
 
     for (const auto& range : builder.fill_ranges()) {
-        m_impl->colour_beat_range(
+        impl->colour_beat_range(
             builder, pink, range,
             {-SOLO_HEIGHT, MEASURE_HEIGHT - 1 + SOLO_HEIGHT},
             RANGE_OPACITY / 2);
     }
 
+    impl->draw_notes(builder);
+
+    return Image {std::move(impl)};
+}
+
+void Image::add_path_layers(const ImageBuilder& builder)
+{
+    constexpr std::array<unsigned char, 3> green {0, 255, 0};
+    constexpr std::array<unsigned char, 3> blue {0, 0, 255};
+    constexpr std::array<unsigned char, 3> yellow {255, 255, 0};
+    constexpr std::array<unsigned char, 3> red {255, 0, 0};
+
+    m_impl->draw_header(builder);
+
     for (const auto& range : builder.unison_ranges()) {
         m_impl->colour_beat_range(builder, yellow, range, {-SOLO_HEIGHT, -1},
                                   RANGE_OPACITY / 2);
@@ -612,7 +633,6 @@ Image::Image(const ImageBuilder& builder)
             RANGE_OPACITY / 2);
     }
 
-    m_impl->draw_notes(builder);
     m_impl->draw_score_totals(builder);
 
     for (const auto& range : builder.green_ranges()) {
@@ -18,7 +18,10 @@
 
 #include <cstdint>
 #include <iterator>
+#include <optional>
 #include <stdexcept>
+#include <string>
+#include <utility>
 
 #include "imagebuilder.hpp"
 #include "optimiser.hpp"
@@ -369,6 +372,13 @@ void ImageBuilder::add_bpms(const SightRead::TempoMap& tempo_map)
 
 void ImageBuilder::add_bre(const SightRead::BigRockEnding& bre,
                            const SightRead::TempoMap& tempo_map)
+{
+    m_bre_ranges.emplace_back(tempo_map.to_beats(bre.start).value(),
+                              tempo_map.to_beats(bre.end).value());
+}
+
+void ImageBuilder::add_bre_bonus(const SightRead::BigRockEnding& bre,
+                                 const SightRead::TempoMap& tempo_map)
 {
     const auto seconds_start = tempo_map.to_seconds(bre.start);
     const auto seconds_end = tempo_map.to_seconds(bre.end);
@@ -377,9 +387,6 @@ void ImageBuilder::add_bre(const SightRead::BigRockEnding& bre,
 
     m_total_score += bre_value;
     m_score_values.back() += bre_value;
-
-    m_bre_ranges.emplace_back(tempo_map.to_beats(bre.start).value(),
-                              tempo_map.to_beats(bre.end).value());
 }
 
 void ImageBuilder::add_drum_fills(const SightRead::NoteTrack& track)
@@ -667,11 +674,11 @@ void ImageBuilder::set_total_score(const PointSet& points,
     m_total_score = no_sp_score + path.score_boost;
 }
 
-ImageBuilder make_builder(SightRead::Song& song,
-                          const SightRead::NoteTrack& track,
-                          const Settings& settings,
-                          const std::function<void(const char*)>& write,
-                          const std::atomic<bool>* terminate)
+namespace {
+// Applies the engine and drum settings to the track, then speeds up the song.
+SightRead::NoteTrack prepare_track(SightRead::Song& song,
+                                   const SightRead::NoteTrack& track,
+                                   const Settings& settings)
 {
     auto new_track = track;
     if (song.global_data().is_from_midi()) {
@@ -688,8 +695,136 @@ ImageBuilder make_builder(SightRead::Song& song,
         }
     }
     song.speedup(settings.speed);
+    return new_track;
+}
+
+// The song is on the heap so that in watch mode it can outlive the call that
+// made it, together with the optimiser that points to it.
+std::unique_ptr<const ProcessedSong>
+make_processed_song(const SightRead::Song& song,
+                    const SightRead::NoteTrack& new_track,
+                    const Settings& settings,
+                    const std::vector<SightRead::Tick>& unison_positions)
+{
+    const SpTimeMap time_map {song.global_data().tempo_map(),
+                              settings.engine->sp_mode()};
+    return std::make_unique<const ProcessedSong>(
+        new_track, time_map, settings.squeeze_settings, settings.drum_settings,
+        *settings.engine, song.global_data().od_beats(), unison_positions);
+}
+
+std::vector<SightRead::Tick> unison_phrase_positions(SightRead::Song& song,
+                                                     const Settings& settings)
+{
+    if (!settings.engine->has_unison_bonuses()) {
+        return {};
+    }
+    return song.unison_phrase_positions();
+}
+
+bool is_optimisation_disabled(const SightRead::NoteTrack& track,
+                              const Settings& settings)
+{
+    return track.track_type() == SightRead::TrackType::Drums
+        && settings.engine->is_rock_band();
+}
+
+struct OptimisedPath {
+    Path path;
+    // Kept so that watch mode can reuse its memo.
+    std::unique_ptr<Optimiser> optimiser;
+};
+
+// Runs the optimiser and writes the path summary.
+OptimisedPath optimise_path(const ProcessedSong& processed_track,
+                            const Settings& settings,
+                            const std::function<void(const char*)>& write,
+                            const std::atomic<bool>* terminate,
+                            const WatchState* watch_state)
+{
+    // The 0.1% squeeze minimum is to get around dumb floating point rounding
+    // issues that visibly affect the path at 0% squeeze.
+    auto squeeze_settings = settings.squeeze_settings;
+    constexpr double SQUEEZE_EPSILON = 0.001;
+    squeeze_settings.squeeze
+        = std::max(squeeze_settings.squeeze, SQUEEZE_EPSILON);
+
+    write("Optimising, please wait...");
+    auto owned_optimiser = std::make_unique<Optimiser>(
+        &processed_track, terminate, settings.speed,
+        squeeze_settings.whammy_delay);
+    auto& optimiser = *owned_optimiser;
+    if (watch_state != nullptr && watch_state->optimiser != nullptr) {
+        const auto reused_entries
+            = optimiser.reuse_memo(*watch_state->optimiser);
+        const auto reuse_message = "Reused " + std::to_string(reused_entries)
+            + " results from the previous run";
+        write(reuse_message.c_str());
+    }
+    if (!settings.checkpoint_path.empty()) {
+        optimiser.set_checkpoint(settings.checkpoint_path,
+                                 settings.checkpoint_interval);
+    }
+    if (settings.max_memory.has_value()) {
+        optimiser.set_max_memory(*settings.max_memory);
+    }
+    Path path;
+    auto is_optimal = true;
+    std::vector<Path> alternative_paths;
+    if (settings.time_limit.has_value()) {
+        auto result = optimiser.best_path_within(*settings.time_limit);
+        path = std::move(result.path);
+        is_optimal = result.is_optimal;
+    } else if (settings.alternatives > 0) {
+        alternative_paths = optimiser.best_paths(settings.alternatives + 1);
+        path = std::move(alternative_paths.front());
+        alternative_paths.erase(alternative_paths.begin());
+    } else {
+        path = optimiser.optimal_path();
+    }
+    write(processed_track.path_summary(path).c_str());
+    if (!is_optimal) {
+        write("Time limit reached, path may not be optimal");
+    }
+    for (auto i = 0U; i < alternative_paths.size(); ++i) {
+        const auto summary = "Alternative " + std::to_string(i + 1) + ":\n"
+            + processed_track.path_summary(alternative_paths[i]);
+        write(summary.c_str());
+    }
+    if (settings.max_memory.has_value()) {
+        constexpr std::size_t BYTES_PER_KIB = 1024;
+        const auto stats = optimiser.cache_stats();
+        const auto stats_message = "Memo evictions: "
+            + std::to_string(stats.evictions) + ", recomputations: "
+            + std::to_string(stats.recomputations) + ", peak size: "
+            + std::to_string(stats.peak_memo_bytes / BYTES_PER_KIB) + " KiB";
+        write(stats_message.c_str());
+    }
+    return {std::move(path), std::move(owned_optimiser)};
+}
+
+void keep_for_watch(WatchState* watch_state,
+                    std::unique_ptr<const ProcessedSong> processed_song,
+                    std::unique_ptr<Optimiser> optimiser)
+{
+    if (watch_state != nullptr && optimiser != nullptr) {
+        watch_state->optimiser = std::move(optimiser);
+        watch_state->processed_song = std::move(processed_song);
+    }
+}
+}
+
+ImageBuilder make_builder(SightRead::Song& song,
+                          const SightRead::NoteTrack& track,
+                          const Settings& settings,
+                          const std::function<void(const char*)>& write,
+                          const std::atomic<bool>* terminate,
+                          WatchState* watch_state,
+                          const std::function<void(const ImageBuilder&)>&
+                              on_static_layers)
+{
+    const auto new_track = prepare_track(song, track, settings);
     const auto& tempo_map = song.global_data().tempo_map();
-    const SpTimeMap time_map {tempo_map, settings.engine->sp_mode()};
 
     auto builder = build_with_engine_params(new_track, settings);
     builder.add_song_header(song.global_data());
@@ -713,40 +848,38 @@ ImageBuilder make_builder(SightRead::Song& song,
         builder.add_time_sigs(tempo_map);
     }
 
-    const auto unison_positions = (settings.engine->has_unison_bonuses())
-        ? song.unison_phrase_positions()
-        : std::vector<SightRead::Tick> {};
+    std::optional<SightRead::BigRockEnding> bre;
+    if (settings.engine->has_bres()) {
+        bre = new_track.bre();
+    }
+    if (bre.has_value()) {
+        builder.add_bre(*bre, tempo_map);
+    }
 
-    // The 0.1% squeeze minimum is to get around dumb floating point rounding
-    // issues that visibly affect the path at 0% squeeze.
-    auto squeeze_settings = settings.squeeze_settings;
-    constexpr double SQUEEZE_EPSILON = 0.001;
-    squeeze_settings.squeeze
-        = std::max(squeeze_settings.squeeze, SQUEEZE_EPSILON);
-    const ProcessedSong processed_track {new_track,
-                                         time_map,
-                                         settings.squeeze_settings,
-                                         settings.drum_settings,
-                                         *settings.engine,
-                                         song.global_data().od_beats(),
-                                         unison_positions};
+    // Nothing added to the builder from here on is drawn by
+    // Image::static_layers, so the caller can start on the image while the
+    // path is optimised.
+    if (on_static_layers) {
+        on_static_layers(builder);
+    }
+
+    const auto unison_positions = unison_phrase_positions(song, settings);
+    auto processed_song
+        = make_processed_song(song, new_track, settings, unison_positions);
+    const auto& processed_track = *processed_song;
+    std::unique_ptr<Optimiser> optimiser;
     Path path;
 
     if (!settings.blank) {
-        const auto is_rb_drums
-            = track.track_type() == SightRead::TrackType::Drums
-            && settings.engine->is_rock_band();
-        if (is_rb_drums) {
+        if (is_optimisation_disabled(track, settings)) {
             write("Optimisation disabled for Rock Band drums, planned for a "
                   "future release");
             builder.add_sp_phrases(new_track, unison_positions, path);
         } else {
-            write("Optimising, please wait...");
-            const Optimiser optimiser {&processed_track, terminate,
-                                       settings.speed,
-                                       squeeze_settings.whammy_delay};
-            path = optimiser.optimal_path();
-            write(processed_track.path_summary(path).c_str());
+            auto result = optimise_path(processed_track, settings, write,
+                                        terminate, watch_state);
+            path = std::move(result.path);
+            optimiser = std::move(result.optimiser);
             builder.add_sp_phrases(new_track, unison_positions, path);
             builder.add_sp_acts(processed_track.points(), tempo_map, path);
             builder.activation_opacity() = settings.opacity;
@@ -759,16 +892,42 @@ ImageBuilder make_builder(SightRead::Song& song,
     if (settings.blank || !settings.engine->overlaps()) {
         builder.add_sp_values(processed_track.sp_data(), *settings.engine);
     } else {
-        builder.add_sp_percent_values(processed_track.sp_data(), time_map,
+        builder.add_sp_percent_values(processed_track.sp_data(),
+                                      processed_track.sp_time_map(),
                                       processed_track.points(), path);
     }
     builder.set_total_score(processed_track.points(), solos, path);
-    if (settings.engine->has_bres() && new_track.bre().has_value()) {
-        const auto bre = new_track.bre();
-        if (bre.has_value()) {
-            builder.add_bre(*bre, tempo_map);
-        }
+    if (bre.has_value()) {
+        builder.add_bre_bonus(*bre, tempo_map);
     }
 
+    keep_for_watch(watch_state, std::move(processed_song),
+                   std::move(optimiser));
+
     return builder;
 }
+
+void write_path_summary(SightRead::Song& song,
+                        const SightRead::NoteTrack& track,
+                        const Settings& settings,
+                        const std::function<void(const char*)>& write,
+                        const std::atomic<bool>* terminate,
+                        WatchState* watch_state)
+{
+    if (settings.blank) {
+        return;
+    }
+    if (is_optimisation_disabled(track, settings)) {
+        write("Optimisation disabled for Rock Band drums, planned for a "
+              "future release");
+        return;
+    }
+
+    const auto new_track = prepare_track(song, track, settings);
+    auto processed_song = make_processed_song(
+        song, new_track, settings, unison_phrase_positions(song, settings));
+    auto result = optimise_path(*processed_song, settings, write, terminate,
+                                watch_state);
+    keep_for_watch(watch_state, std::move(processed_song),
+                   std::move(result.optimiser));
+}
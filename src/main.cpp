@@ -19,8 +19,10 @@
 #include <atomic>
 #include <cstdio>
 #include <exception>
+#include <future>
 
 #include <QCoreApplication>
+#include <QFileSystemWatcher>
 #include <QTextStream>
 
 #include <sightread/time.hpp>
@@ -41,20 +43,63 @@ int main(int argc, char** argv)
         QCoreApplication::setApplicationVersion("1.8.1");
 
         const auto settings = from_args(QCoreApplication::arguments());
-        const SongFile song_file {settings.filename};
-        auto song = song_file.load_song(settings.game);
-        const auto& track
-            = song.track(settings.instrument, settings.difficulty);
         const std::atomic<bool> terminate {false};
-        const auto builder = make_builder(
-            song, track, settings, [&](auto p) { q_stdout << p << '\n'; },
-            &terminate);
-        q_stdout.flush();
-        if (settings.draw_image) {
-            const Image image {builder};
+        WatchState watch_state;
+        const auto run = [&] {
+            const SongFile song_file {settings.filename};
+            auto song = song_file.load_song(settings.game);
+            const auto& track
+                = song.track(settings.instrument, settings.difficulty);
+            const auto write = [&](const char* p) { q_stdout << p << '\n'; };
+            auto* const run_watch_state
+                = settings.watch ? &watch_state : nullptr;
+            if (!settings.draw_image) {
+                write_path_summary(song, track, settings, write, &terminate,
+                                   run_watch_state);
+                q_stdout.flush();
+                return;
+            }
+            // The parts of the image that do not depend on the path are drawn
+            // on another thread while the optimiser runs.
+            std::future<Image> static_image;
+            const auto start_image = [&](const ImageBuilder& static_builder) {
+                static_image
+                    = std::async(std::launch::async, [static_builder] {
+                          return Image::static_layers(static_builder);
+                      });
+            };
+            const auto builder
+                = make_builder(song, track, settings, write, &terminate,
+                               run_watch_state, start_image);
+            q_stdout.flush();
+            auto image = static_image.get();
+            image.add_path_layers(builder);
             image.save(settings.image_path.c_str());
+        };
+        run();
+        if (!settings.watch) {
+            return EXIT_SUCCESS;
         }
-        return EXIT_SUCCESS;
+
+        const auto filename = QString::fromStdString(settings.filename);
+        QFileSystemWatcher watcher {{filename}};
+        QObject::connect(
+            &watcher, &QFileSystemWatcher::fileChanged, [&](const QString&) {
+                // Editors that save by replacing the file drop it from the
+                // watcher, so it is added back.
+                if (!watcher.files().contains(filename)) {
+                    watcher.addPath(filename);
+                }
+                try {
+                    run();
+                } catch (const std::exception& e) {
+                    q_stderr << "Error: " << e.what() << '\n';
+                    q_stderr.flush();
+                }
+            });
+        q_stdout << "Watching " << filename << " for changes\n";
+        q_stdout.flush();
+        return QCoreApplication::exec();
     } catch (const std::exception& e) {
         q_stderr << "Error: " << e.what() << '\n';
         return EXIT_FAILURE;
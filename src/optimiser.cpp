@@ -16,12 +16,255 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <future>
 #include <iterator>
+#include <queue>
+#include <set>
 #include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
 
 #include "optimiser.hpp"
 
+namespace {
+// Splits [0, count) into contiguous chunks and returns f(begin, end) for each
+// chunk, in order. Chunks are run on separate threads when there is enough work
+// to give each at least min_chunk_size elements; otherwise f is called once on
+// the whole range on this thread. The last chunk is always run on this thread,
+// so it does not sit idle waiting for the others.
+template <typename F>
+auto map_chunks(std::size_t count, std::size_t min_chunk_size, F f)
+{
+    using Result = decltype(f(std::size_t {}, std::size_t {}));
+
+    const std::size_t thread_count
+        = std::max(std::thread::hardware_concurrency(), 1U);
+    const auto max_chunk_count
+        = count / std::max(min_chunk_size, std::size_t {1});
+    const auto chunk_count = std::min(thread_count, max_chunk_count);
+    std::vector<Result> results;
+    if (chunk_count <= 1) {
+        results.push_back(f(0, count));
+        return results;
+    }
+
+    std::vector<std::future<Result>> futures;
+    futures.reserve(chunk_count - 1);
+    for (auto i = 0U; i < chunk_count - 1; ++i) {
+        const auto begin = count * i / chunk_count;
+        const auto end = count * (i + 1) / chunk_count;
+        futures.push_back(std::async(std::launch::async, f, begin, end));
+    }
+    auto last_result = f(count * (chunk_count - 1) / chunk_count, count);
+    results.reserve(chunk_count);
+    for (auto& future : futures) {
+        results.push_back(future.get());
+    }
+    results.push_back(std::move(last_result));
+    return results;
+}
+
+// Returns how many cells a bisection over an interval of the given width
+// splits it into before they are no wider than threshold.
+std::uint32_t bisection_cells(double width, double threshold)
+{
+    std::uint32_t cells = 1;
+    while (width > threshold) {
+        width /= 2;
+        cells *= 2;
+    }
+    return cells;
+}
+
+// Returns the value a bisection from low to high over count cells tries at
+// index i, where 0 < i < count, worked out the same way so that it comes out
+// exactly the same.
+template <typename T>
+T bisection_point(T low, T high, std::uint32_t i, std::uint32_t count)
+{
+    std::uint32_t low_index = 0;
+    auto high_index = count;
+    while (true) {
+        const auto mid_index = low_index + (high_index - low_index) / 2;
+        const auto mid = (low + high) * (1.0 / 2);
+        if (i == mid_index) {
+            return mid;
+        }
+        if (i < mid_index) {
+            high = mid;
+            high_index = mid_index;
+        } else {
+            low = mid;
+            low_index = mid_index;
+        }
+    }
+}
+
+// Returns the bracket of indices in [0, count] a bisection stops with. The
+// bisection starts from [0, count], with 0 taken to lack the outcome count has,
+// success if end_success is set, and count to have it. Until is_finished(low,
+// high), it tries the middle index and keeps the half the outcome changes in.
+// Given the outcome changes only once, the same bracket is found here with
+// fewer trials. Each trial's sp_margin is piecewise linear in the index, so the
+// change is first narrowed down by trying where the line through the margins
+// at either end of the known bracket crosses zero, or the midpoint if the last
+// trial failed to halve it. This is cut short once the highest index known to
+// lack the end outcome reaches stop. The bisection is then replayed, only
+// trying the indices this leaves open.
+template <typename F, typename G>
+std::tuple<std::uint32_t, std::uint32_t>
+find_outcome_change(std::uint32_t count, bool end_success, F trial,
+                    G is_finished, std::uint32_t stop)
+{
+    const auto has_end_outcome = [&](const ActResult& result) {
+        return (result.validity == ActValidity::success) == end_success;
+    };
+
+    // The highest index known to lack the end outcome and the lowest index
+    // known to have it.
+    std::uint32_t known_low = 0;
+    auto known_high = count;
+    if (count > 2) {
+        auto low_result = trial(1);
+        if (has_end_outcome(low_result)) {
+            known_high = 1;
+        } else {
+            known_low = 1;
+        }
+        if (known_low == 1 && stop > 1) {
+            auto high_result = trial(count - 1);
+            if (has_end_outcome(high_result)) {
+                known_high = count - 1;
+            } else {
+                known_low = count - 1;
+            }
+            auto should_bisect = false;
+            while (known_high - known_low > 1 && known_low < stop) {
+                auto next = known_low + (known_high - known_low) / 2;
+                const auto low_margin = low_result.sp_margin;
+                const auto high_margin = high_result.sp_margin;
+                if (!should_bisect && std::isfinite(low_margin)
+                    && std::isfinite(high_margin)
+                    && low_margin != high_margin) {
+                    const auto crossing = known_low
+                        + (known_high - known_low)
+                            * (low_margin / (low_margin - high_margin));
+                    next = static_cast<std::uint32_t>(std::clamp(
+                        std::ceil(crossing),
+                        static_cast<double>(known_low + 1),
+                        static_cast<double>(known_high - 1)));
+                }
+                const auto width = known_high - known_low;
+                const auto result = trial(next);
+                if (has_end_outcome(result)) {
+                    known_high = next;
+                    high_result = result;
+                } else {
+                    known_low = next;
+                    low_result = result;
+                }
+                should_bisect = 2 * (known_high - known_low) > width;
+            }
+        }
+    }
+
+    std::uint32_t low = 0;
+    auto high = count;
+    while (high - low > 1 && !is_finished(low, high)) {
+        const auto mid = low + (high - low) / 2;
+        auto mid_has_end_outcome = mid >= known_high;
+        if (mid > known_low && mid < known_high) {
+            mid_has_end_outcome = has_end_outcome(trial(mid));
+        }
+        if (mid_has_end_outcome) {
+            high = mid;
+        } else {
+            low = mid;
+        }
+    }
+    return {low, high};
+}
+
+#ifndef NDEBUG
+// The bisection find_outcome_change stands in for, to check it against in
+// debug builds.
+template <typename F, typename G>
+std::tuple<std::uint32_t, std::uint32_t>
+bisect_outcome_change(std::uint32_t count, bool end_success, F trial,
+                      G is_finished)
+{
+    std::uint32_t low = 0;
+    auto high = count;
+    while (high - low > 1 && !is_finished(low, high)) {
+        const auto mid = low + (high - low) / 2;
+        if ((trial(mid).validity == ActValidity::success) == end_success) {
+            high = mid;
+        } else {
+            low = mid;
+        }
+    }
+    return {low, high};
+}
+#endif
+
+void lower_to(std::atomic<double>& bound, double value)
+{
+    auto current = bound.load();
+    while (value < current && !bound.compare_exchange_weak(current, value)) {
+    }
+}
+
+// Checkpoints start with CHECKPOINT_MAGIC and the fingerprint of the song and
+// settings, followed by one record per cache entry and one per later extension
+// of an entry's valid_until. Values are written in the machine's own byte
+// order, since a checkpoint is only meant to be resumed where it was written.
+constexpr std::array<char, 8> CHECKPOINT_MAGIC {'C', 'H', 'O', 'P',
+                                                'T', 'C', 'P', '3'};
+constexpr std::uint8_t PATH_RECORD = 0;
+constexpr std::uint8_t FULL_SP_PATH_RECORD = 1;
+constexpr std::uint8_t VALID_UNTIL_RECORD = 2;
+
+template <typename T> void write_value(std::string& buffer, T value)
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+
+    std::array<char, sizeof(T)> bytes {};
+    std::memcpy(bytes.data(), &value, sizeof(T));
+    buffer.append(bytes.data(), bytes.size());
+}
+
+template <typename T> bool read_value(std::istream& stream, T& value)
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+
+    std::array<char, sizeof(T)> bytes {};
+    if (!stream.read(bytes.data(), bytes.size())) {
+        return false;
+    }
+    std::memcpy(&value, bytes.data(), sizeof(T));
+    return true;
+}
+
+void append_to_file(const std::string& path, const std::string& bytes)
+{
+    std::ofstream file {path, std::ios::binary | std::ios::app};
+    file.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    if (!file) {
+        throw std::runtime_error("Could not write checkpoint to " + path);
+    }
+}
+}
+
 Optimiser::Optimiser(const ProcessedSong* song,
                      const std::atomic<bool>* terminate, int speed,
                      SightRead::Second whammy_delay)
@@ -34,6 +277,7 @@ Optimiser::Optimiser(const ProcessedSong* song,
         throw std::invalid_argument(
             "Optimiser ctor's arguments must be non-null");
     }
+    m_act_end_limits = m_song->act_end_limits();
     const auto& points = m_song->points();
     const auto& sp_data = m_song->sp_data();
 
@@ -45,23 +289,28 @@ Optimiser::Optimiser(const ProcessedSong* song,
         if (p->is_sp_granting_note
             || (p->is_hold_point
                 && sp_data.is_in_whammy_ranges(p->position.beat))) {
+            const auto index = static_cast<std::uint32_t>(
+                std::distance(points.cbegin(), p));
             for (int i = 0; i < count; ++i) {
-                m_next_candidate_points.push_back(p);
+                m_next_candidate_points.push_back(index);
             }
             count = 0;
         }
     }
 
     ++count;
+    const auto end_index = static_cast<std::uint32_t>(capacity - 1);
     for (int i = 0; i < count; ++i) {
-        m_next_candidate_points.push_back(points.cend());
+        m_next_candidate_points.push_back(end_index);
     }
 }
 
 PointPtr Optimiser::next_candidate_point(PointPtr point) const
 {
     const auto index = std::distance(m_song->points().cbegin(), point);
-    return m_next_candidate_points[static_cast<std::size_t>(index)];
+    return std::next(
+        m_song->points().cbegin(),
+        m_next_candidate_points[static_cast<std::size_t>(index)]);
 }
 
 Optimiser::CacheKey Optimiser::advance_cache_key(CacheKey key) const
@@ -91,50 +340,362 @@ Optimiser::CacheKey Optimiser::add_whammy_delay(CacheKey key) const
     return key;
 }
 
-int Optimiser::get_partial_path(CacheKey key, Cache& cache) const
+// The best subpaths from a key depend on the best subpaths of the keys after
+// each activation it could start. Rather than recursing, which goes one level
+// deeper per activation along the chosen path, keys are worked out with an
+// explicit stack. A key's candidates are found first; any later keys they need
+// that are not yet cached are pushed above it, and once those are done the
+// key's value is resolved from the cache. Keys are cached in the same order
+// as a depth-first recursion would, so the cache ends up the same.
+//
+// Returns false if deadline passed before key was worked out. Every key cached
+// by then is still correct.
+bool Optimiser::get_partial_path(CacheKey key, Cache& cache,
+                                 Deadline deadline, bool has_full_sp) const
 {
     if (key.point == m_song->points().cend()) {
-        return 0;
+        return true;
+    }
+
+    std::vector<PathFrame> frames {{key, has_full_sp, std::nullopt}};
+    while (!frames.empty()) {
+        auto& frame = frames.back();
+        if (is_cached(frame, cache)) {
+            frames.pop_back();
+            continue;
+        }
+        if (!frame.pending.has_value()) {
+            if (m_terminate->load()) {
+                close_checkpoint(cache);
+                throw std::runtime_error("Thread halted");
+            }
+            if (deadline.has_value()
+                && std::chrono::steady_clock::now() >= *deadline) {
+                return false;
+            }
+            auto subpath_from_prev = try_previous_best_subpaths(
+                frame.key, cache, frame.has_full_sp);
+            if (subpath_from_prev) {
+                add_path_to_cache(frame.key, std::move(*subpath_from_prev),
+                                  cache);
+                frames.pop_back();
+                continue;
+            }
+            frame.pending = find_best_subpaths(frame.key, frame.has_full_sp);
+            ++m_searched_keys;
+            const auto frame_count = frames.size();
+            push_uncached_dependencies(*frame.pending, cache, frames);
+            if (frames.size() > frame_count) {
+                continue;
+            }
+        }
+
+        // frames may have been reallocated by push_uncached_dependencies, so
+        // the top frame is looked up again.
+        auto& resolved_frame = frames.back();
+        auto best_path = resolve_subpaths(*resolved_frame.pending, cache);
+        if (resolved_frame.has_full_sp) {
+            add_to_cache(resolved_frame.key, true, std::move(best_path),
+                         cache);
+        } else {
+            bound_ties(best_path, resolved_frame.key);
+            add_path_to_cache(resolved_frame.key, std::move(best_path), cache);
+        }
+        frames.pop_back();
+    }
+
+    return true;
+}
+
+std::size_t Optimiser::acts_bytes(const CacheValue& value)
+{
+    return value.possible_next_acts.capacity()
+        * sizeof(std::tuple<ProtoActivation, CacheKey>);
+}
+
+// Caches value for key, which does not have full SP. A later start can't do
+// better, so if the closest earlier key at the same point has the same score,
+// every position in between has it too, and that key's interval is extended
+// to key. A value taken from that key by try_previous_best_subpaths is then
+// not stored at all, as cached_acts can take it from there again.
+void Optimiser::add_path_to_cache(CacheKey key, CacheValue value,
+                                  Cache& cache) const
+{
+    const auto next_entry = cache.paths.lower_bound(key);
+    if (next_entry != cache.paths.begin()) {
+        auto& [prev_key, prev_value] = *std::prev(next_entry);
+        if (prev_key.point == key.point
+            && prev_value.score_boost == value.score_boost) {
+            if (prev_value.valid_until < key.position.beat) {
+                prev_value.valid_until = key.position.beat;
+                if (cache.checkpoint.has_value()) {
+                    save_valid_until_to_checkpoint(prev_key, key.position.beat,
+                                                   cache);
+                }
+            }
+            if (value.source.has_value() && value.source->point == key.point) {
+                return;
+            }
+        }
+    }
+    if (next_entry != cache.paths.end() && next_entry->first.point == key.point
+        && next_entry->second.score_boost == value.score_boost) {
+        value.valid_until = next_entry->first.position.beat;
+    }
+    add_to_cache(key, false, std::move(value), cache);
+}
+
+// Caches value for key, saving it to the checkpoint and evicting entries if
+// the memo is over its memory budget.
+void Optimiser::add_to_cache(CacheKey key, bool has_full_sp, CacheValue value,
+                             Cache& cache) const
+{
+    // A rough size for a map node: three pointers and a colour, rounded up.
+    constexpr auto NODE_BYTES
+        = 4 * sizeof(void*) + sizeof(CacheKey) + sizeof(CacheValue);
+
+    if (!has_full_sp) {
+        value.valid_until = std::max(value.valid_until, key.position.beat);
+    }
+    if (cache.checkpoint.has_value()) {
+        save_to_checkpoint(key, has_full_sp, value, cache);
+    }
+    const auto value_acts_bytes = acts_bytes(value);
+    if (has_full_sp) {
+        if (cache.full_sp_paths.emplace(key.point, std::move(value)).second) {
+            cache.memo_bytes += NODE_BYTES + value_acts_bytes;
+            cache.kept_bytes += NODE_BYTES + value_acts_bytes;
+        }
+    } else if (cache.paths.emplace(key, std::move(value)).second) {
+        cache.memo_bytes += NODE_BYTES;
+        cache.kept_bytes += NODE_BYTES;
+        if (value_acts_bytes > 0) {
+            cache.memo_bytes += value_acts_bytes + sizeof(CacheKey);
+            cache.evictable_keys.push_back(key);
+        }
+    }
+    if (m_max_memory.has_value() && cache.memo_bytes > *m_max_memory) {
+        evict_entries(cache);
+    }
+    m_kept_memo_bytes = cache.kept_bytes;
+    if (cache.memo_bytes > m_peak_memo_bytes) {
+        m_peak_memo_bytes = cache.memo_bytes;
+    }
+}
+
+// Frees the activations of the oldest entries until what the memo holds
+// beyond kept_bytes is back under three quarters of what the budget leaves
+// for it. The search works back from the end of the song, so the oldest
+// entries are mostly the furthest from where it is, and the least likely to
+// be needed again before the path is picked. Scores are never evicted, as
+// every earlier key's score is worked out from them, so if they alone are over
+// the budget every entry's activations are freed and the search carries on.
+void Optimiser::evict_entries(Cache& cache) const
+{
+    const auto target = cache.kept_bytes < *m_max_memory
+        ? cache.kept_bytes + (*m_max_memory - cache.kept_bytes) / 4 * 3
+        : cache.kept_bytes;
+    while (cache.memo_bytes > target && !cache.evictable_keys.empty()) {
+        auto& value = cache.paths.at(cache.evictable_keys.front());
+        cache.evictable_keys.pop_front();
+        cache.memo_bytes -= acts_bytes(value) + sizeof(CacheKey);
+        value.possible_next_acts.clear();
+        value.possible_next_acts.shrink_to_fit();
+        value.is_evicted = true;
+        ++m_evictions;
+    }
+}
+
+// Works out the activations of the evicted entry for key again. An entry taken
+// from an earlier key by try_previous_best_subpaths is worked out from that
+// key's activations, so the result is always the same as when the entry was
+// first cached.
+std::vector<std::tuple<ProtoActivation, Optimiser::CacheKey>>
+Optimiser::recompute_acts(CacheKey key, const Cache& cache) const
+{
+    ++m_recomputations;
+    std::vector<CacheKey> taken_keys;
+    auto base_key = key;
+    while (true) {
+        const auto& value = cache.paths.at(base_key);
+        if (!value.is_evicted || !value.source.has_value()) {
+            break;
+        }
+        taken_keys.push_back(base_key);
+        base_key = *value.source;
+    }
+
+    std::vector<std::tuple<ProtoActivation, CacheKey>> acts;
+    if (const auto& base = cache.paths.at(base_key); !base.is_evicted) {
+        acts = base.possible_next_acts;
+    } else {
+        auto value
+            = resolve_subpaths(find_best_subpaths(base_key, false), cache);
+        bound_ties(value, base_key);
+        acts = std::move(value.possible_next_acts);
+    }
+    for (auto taken_key = taken_keys.crbegin();
+         taken_key != taken_keys.crend(); ++taken_key) {
+        acts = acts_still_possible(acts, *taken_key);
+    }
+    return acts;
+}
+
+// Returns the entry of cache.paths whose interval holds key, or the end of
+// cache.paths if there is none.
+std::map<Optimiser::CacheKey, Optimiser::CacheValue>::const_iterator
+Optimiser::covering_entry(CacheKey key, const Cache& cache)
+{
+    auto entry = cache.paths.upper_bound(key);
+    if (entry == cache.paths.begin()) {
+        return cache.paths.end();
+    }
+    --entry;
+    if (entry->first.point != key.point
+        || entry->second.valid_until < key.position.beat) {
+        return cache.paths.end();
+    }
+    return entry;
+}
+
+bool Optimiser::is_cached(const PathFrame& frame, const Cache& cache)
+{
+    if (frame.has_full_sp) {
+        return cache.full_sp_paths.contains(frame.key.point);
+    }
+    return covering_entry(frame.key, cache) != cache.paths.end();
+}
+
+// Pushes the later keys pending depends on that are not yet cached, so that
+// they are worked out in the order find_best_subpaths found them.
+void Optimiser::push_uncached_dependencies(const PendingSubpaths& pending,
+                                           const Cache& cache,
+                                           std::vector<PathFrame>& frames) const
+{
+    std::vector<PathFrame> dependencies;
+    for (const auto& candidate : pending.candidates) {
+        if (candidate.next_key.point != m_song->points().cend()
+            && covering_entry(candidate.next_key, cache)
+                == cache.paths.end()) {
+            dependencies.push_back({candidate.next_key, false, std::nullopt});
+        }
+    }
+    if (pending.full_sp_point.has_value()
+        && !cache.full_sp_paths.contains(*pending.full_sp_point)) {
+        // We only get a full_sp_point that is not m_points.cbegin(), so we
+        // may look at the point before it.
+        const auto point = *pending.full_sp_point;
+        dependencies.push_back(
+            {{point, std::prev(point)->hit_window_start}, true, std::nullopt});
+    }
+    frames.insert(frames.end(), dependencies.rbegin(), dependencies.rend());
+}
+
+// Works out the best subpaths from the candidates, given every later key they
+// need is cached.
+Optimiser::CacheValue
+Optimiser::resolve_subpaths(const PendingSubpaths& pending,
+                            const Cache& cache) const
+{
+    std::vector<std::tuple<ProtoActivation, CacheKey>> acts;
+    auto best_score_boost = 0;
+
+    for (const auto& [act, next_key, act_score] : pending.candidates) {
+        auto rest_of_path_score_boost = 0;
+        if (next_key.point != m_song->points().cend()) {
+            const auto entry = covering_entry(next_key, cache);
+            assert(entry != cache.paths.end()); // NOLINT
+            rest_of_path_score_boost = entry->second.score_boost;
+        }
+        const auto score = act_score + rest_of_path_score_boost;
+        if (score > best_score_boost) {
+            best_score_boost = score;
+            acts.clear();
+            acts.emplace_back(act, next_key);
+        } else if (score == best_score_boost) {
+            acts.emplace_back(act, next_key);
+        }
     }
-    if (cache.paths.find(key) == cache.paths.end()) {
-        if (m_terminate->load()) {
-            throw std::runtime_error("Thread halted");
+
+    if (pending.full_sp_point.has_value()) {
+        const auto& cache_value
+            = cache.full_sp_paths.at(*pending.full_sp_point);
+        if (cache_value.score_boost > best_score_boost) {
+            return cache_value;
+        }
+        if (cache_value.score_boost == best_score_boost) {
+            const auto& next_acts = cache_value.possible_next_acts;
+            acts.insert(acts.end(), next_acts.cbegin(), next_acts.cend());
         }
-        auto best_path = find_best_subpaths(key, cache, false);
-        cache.paths.emplace(key, best_path);
-        return best_path.score_boost;
     }
-    return cache.paths.at(key).score_boost;
+
+    return {acts, best_score_boost};
 }
 
-int Optimiser::get_partial_full_sp_path(PointPtr point, Cache& cache) const
+// If value has more than MAX_STORED_TIES activations, keeps MAX_STORED_TIES of
+// them: the earliest that are possible at the lowest squeeze level
+// act_squeeze_level returns, then the earliest of the rest. This needs one
+// validity check per activation rather than a bisection, so the squeeze
+// levels are only bisected when the path is built. optimal_path picks the
+// earliest activation with the lowest squeeze level, so as long as one is
+// possible at the lowest level, it makes the same choice from the kept
+// activations, which stay in their original order, as from the full list. If
+// none is, the choice depends on squeeze levels the check does not give, so
+// every activation is kept.
+// Full SP paths are not bounded, since their activations are merged into
+// other keys' lists and judged from those keys.
+void Optimiser::bound_ties(CacheValue& value, CacheKey key) const
 {
-    if (cache.full_sp_paths.find(point) != cache.full_sp_paths.end()) {
-        return cache.full_sp_paths.at(point).score_boost;
+    auto& acts = value.possible_next_acts;
+    if (acts.size() <= MAX_STORED_TIES) {
+        return;
     }
 
-    // We only call this from find_best_subpath in a situaiton where we know
-    // point is not m_points.cend(), so we may assume point is a real Point.
-    CacheKey key {point, std::prev(point)->hit_window_start};
-    auto best_path = find_best_subpaths(key, cache, true);
-    cache.full_sp_paths.emplace(point, best_path);
-    return best_path.score_boost;
+    std::vector<bool> is_kept(acts.size(), false);
+    std::size_t kept_count = 0;
+    for (auto i = 0U; i < acts.size() && kept_count < MAX_STORED_TIES; ++i) {
+        if (squeezed_act_result(std::get<0>(acts[i]), key, MIN_SQZ_LEVEL)
+                .validity
+            == ActValidity::success) {
+            is_kept[i] = true;
+            ++kept_count;
+        }
+    }
+    if (kept_count == 0) {
+        return;
+    }
+    for (auto i = 0U; i < acts.size() && kept_count < MAX_STORED_TIES; ++i) {
+        if (!is_kept[i]) {
+            is_kept[i] = true;
+            ++kept_count;
+        }
+    }
+
+    std::vector<std::tuple<ProtoActivation, CacheKey>> kept_acts;
+    kept_acts.reserve(MAX_STORED_TIES);
+    for (auto i = 0U; i < acts.size(); ++i) {
+        if (is_kept[i]) {
+            kept_acts.push_back(acts[i]);
+        }
+    }
+    acts = std::move(kept_acts);
+    value.ties_truncated = true;
 }
 
-// This function is an optimisation for the case where key.point is a tick in
-// the middle of an SP granting sustain. It is often the case that adjacent
-// ticks have the same optimal subpath, and at any rate the optimal subpath
-// can't be better than the optimal subpath for the previous point, so we try it
-// first. If it works, we return the result, else we return an empty optional.
+// This function is an optimisation for two cases. The first is where a key at
+// the same point but an earlier position is cached: a later start can't do
+// better, so the cached result holds over the whole interval between the two
+// positions as long as one of its activations is still possible. The second is
+// where key.point is a tick in the middle of an SP granting sustain. It is
+// often the case that adjacent ticks have the same optimal subpath, and at any
+// rate the optimal subpath can't be better than the optimal subpath for the
+// previous point. In either case we try the cached result first. If it works,
+// we return the result, else we return an empty optional.
 std::optional<Optimiser::CacheValue>
 Optimiser::try_previous_best_subpaths(CacheKey key, const Cache& cache,
                                       bool has_full_sp) const
 {
-    if (has_full_sp || !key.point->is_hold_point) {
-        return std::nullopt;
-    }
-    if (key.point != m_song->points().cbegin()
-        && !std::prev(key.point)->is_hold_point) {
+    if (has_full_sp) {
         return std::nullopt;
     }
 
@@ -144,11 +705,46 @@ Optimiser::try_previous_best_subpaths(CacheKey key, const Cache& cache,
     }
 
     prev_key_iter = std::prev(prev_key_iter);
-    if (std::distance(prev_key_iter->first.point, key.point) > 1) {
+    const auto& [prev_key, prev_value] = *prev_key_iter;
+    // A truncated list may be missing the activation optimal_path would pick
+    // from key, so it can't be reused.
+    if (prev_value.ties_truncated) {
         return std::nullopt;
     }
+    if (prev_key.point != key.point) {
+        if (!key.point->is_hold_point) {
+            return std::nullopt;
+        }
+        if (key.point != m_song->points().cbegin()
+            && !std::prev(key.point)->is_hold_point) {
+            return std::nullopt;
+        }
+        if (std::distance(prev_key.point, key.point) > 1) {
+            return std::nullopt;
+        }
+    }
 
-    const auto& acts = prev_key_iter->second.possible_next_acts;
+    std::vector<std::tuple<ProtoActivation, CacheKey>> restored_acts;
+    if (prev_value.is_evicted) {
+        restored_acts = recompute_acts(prev_key, cache);
+    }
+    auto next_acts = acts_still_possible(
+        prev_value.is_evicted ? restored_acts : prev_value.possible_next_acts,
+        key);
+    if (next_acts.empty()) {
+        return std::nullopt;
+    }
+
+    return {{std::move(next_acts), prev_value.score_boost, false, prev_key}};
+}
+
+// Returns the activations in acts that are still valid when starting from
+// key, and end no later than the key they lead to.
+std::vector<std::tuple<ProtoActivation, Optimiser::CacheKey>>
+Optimiser::acts_still_possible(
+    const std::vector<std::tuple<ProtoActivation, CacheKey>>& acts,
+    CacheKey key) const
+{
     std::vector<std::tuple<ProtoActivation, CacheKey>> next_acts;
     for (const auto& act : acts) {
         auto [p, q] = std::get<0>(act);
@@ -164,23 +760,29 @@ Optimiser::try_previous_best_subpaths(CacheKey key, const Cache& cache,
             next_acts.push_back(act);
         }
     }
-    if (next_acts.empty()) {
-        return std::nullopt;
-    }
-
-    const auto score_boost = prev_key_iter->second.score_boost;
-    return {{next_acts, score_boost}};
+    return next_acts;
 }
 
-// This function takes some information and completes the optimal subpaths from
-// it.
+// This function takes some information and finds the activations starting at
+// p that the optimal subpaths could use.
 void Optimiser::complete_subpath(
     PointPtr p, SpPosition starting_pos, SpBar sp_bar,
-    PointPtrRangeSet& attained_act_ends, Cache& cache, int& best_score_boost,
-    std::vector<std::tuple<ProtoActivation, CacheKey>>& acts) const
+    PointPtrRangeSet& attained_act_ends,
+    std::vector<SubpathCandidate>& candidates) const
 {
+    const auto& points = m_song->points();
+    const auto act_end_limit = std::next(
+        points.cbegin(),
+        m_act_end_limits[static_cast<std::size_t>(
+            std::distance(points.cbegin(), p))]);
+    assert(act_end_limit == points.cend() // NOLINT
+           || m_song->is_candidate_valid({p, act_end_limit, starting_pos,
+                                          sp_bar})
+                   .validity
+               == ActValidity::insufficient_sp);
+
     for (auto q = attained_act_ends.lowest_absent_element();
-         q < m_song->points().cend();) {
+         q < act_end_limit;) {
         if (attained_act_ends.contains(q)) {
             ++q;
             continue;
@@ -211,15 +813,7 @@ void Optimiser::complete_subpath(
         CacheKey next_key {m_song->points().first_after_current_phrase(q),
                            candidate_result.ending_position};
         next_key = advance_cache_key(next_key);
-        const auto rest_of_path_score_boost = get_partial_path(next_key, cache);
-        const auto score = act_score + rest_of_path_score_boost;
-        if (score > best_score_boost) {
-            best_score_boost = score;
-            acts.clear();
-            acts.push_back({{p, q}, next_key});
-        } else if (score == best_score_boost) {
-            acts.push_back({{p, q}, next_key});
-        }
+        candidates.push_back({{p, q}, next_key, act_score});
         ++q;
     }
 }
@@ -231,40 +825,40 @@ SightRead::Second Optimiser::earliest_fill_appearance(CacheKey key,
         return SightRead::Second(0.0);
     }
 
-    int sp_count = 0;
-    for (auto p = key.point; p < m_song->points().cend(); ++p) {
-        if (p->is_sp_granting_note) {
-            ++sp_count;
-            if (sp_count == 2) {
-                return m_song->sp_time_map().to_seconds(
-                           p->hit_window_start.beat)
-                    + m_drum_fill_delay;
-            }
-        }
+    const auto& points = m_song->points();
+    const auto first_sp_note = points.next_sp_granting_note(key.point);
+    if (first_sp_note == points.cend()) {
+        return SightRead::Second(0.0);
     }
-
-    return SightRead::Second(0.0);
+    const auto second_sp_note
+        = points.next_sp_granting_note(std::next(first_sp_note));
+    if (second_sp_note == points.cend()) {
+        return SightRead::Second(0.0);
+    }
+    return second_sp_note->hit_window_start_seconds + m_drum_fill_delay;
 }
 
-Optimiser::CacheValue Optimiser::find_best_subpaths(CacheKey key, Cache& cache,
-                                                    bool has_full_sp) const
+Optimiser::PendingSubpaths
+Optimiser::find_best_subpaths(CacheKey key, bool has_full_sp,
+                              double initial_sp) const
 {
-    const auto subpath_from_prev
-        = try_previous_best_subpaths(key, cache, has_full_sp);
-    if (subpath_from_prev) {
-        return *subpath_from_prev;
-    }
-
+    const auto is_drums = m_song->is_drums();
     const auto early_act_bound = earliest_fill_appearance(key, has_full_sp);
-    std::vector<std::tuple<ProtoActivation, CacheKey>> acts;
-    PointPtrRangeSet attained_act_ends {key.point, m_song->points().cend()};
+    PendingSubpaths pending;
+    // Each thread keeps one set for all its searches, so that its storage is
+    // only allocated once.
+    thread_local PointPtrRangeSet attained_act_ends;
+    attained_act_ends.reset(key.point, m_song->points().cend());
     auto lower_bound_set = false;
-    auto best_score_boost = 0;
 
-    for (auto p = key.point; p < m_song->points().cend(); ++p) {
-        if (m_song->is_drums()
-            && (!p->fill_start.has_value()
-                || p->fill_start < early_act_bound)) {
+    // Drum activations can only start on points with a fill, so on drums the
+    // points in between are skipped over.
+    const auto& points = m_song->points();
+    const auto next_start
+        = [&](PointPtr p) { return is_drums ? points.next_fill_point(p) : p; };
+    for (auto p = next_start(key.point); p < points.cend();
+         p = next_start(std::next(p))) {
+        if (is_drums && p->fill_start < early_act_bound) {
             continue;
         }
         SpBar sp_bar {1.0, 1.0};
@@ -276,11 +870,11 @@ Optimiser::CacheValue Optimiser::find_best_subpaths(CacheKey key, Cache& cache,
         if (!has_full_sp) {
             const auto& [new_sp, new_pos]
                 = m_song->total_available_sp_with_earliest_pos(
-                    key.position.beat, key.point, p, starting_pos);
+                    key.position.beat, key.point, p, starting_pos, initial_sp);
             sp_bar = new_sp;
             starting_pos = new_pos;
         }
-        if (m_song->is_drums()) {
+        if (is_drums) {
             starting_pos.beat
                 = std::max(starting_pos.beat, p->hit_window_start.beat);
             starting_pos.sp_measure = std::max(starting_pos.sp_measure,
@@ -291,15 +885,7 @@ Optimiser::CacheValue Optimiser::find_best_subpaths(CacheKey key, Cache& cache,
         }
         if (p != key.point && sp_bar.min() == 1.0
             && std::prev(p)->is_sp_granting_note) {
-            get_partial_full_sp_path(p, cache);
-            auto cache_value = cache.full_sp_paths.at(p);
-            if (cache_value.score_boost > best_score_boost) {
-                return cache_value;
-            }
-            if (cache_value.score_boost == best_score_boost) {
-                const auto& next_acts = cache_value.possible_next_acts;
-                acts.insert(acts.end(), next_acts.cbegin(), next_acts.cend());
-            }
+            pending.full_sp_point = p;
             break;
         }
         // This skips some points that are too early to be an act end for the
@@ -313,95 +899,920 @@ Optimiser::CacheValue Optimiser::find_best_subpaths(CacheKey key, Cache& cache,
                     return pt.hit_window_end.sp_measure <= earliest_act_end;
                 });
             --earliest_pt_end;
-            attained_act_ends
-                = PointPtrRangeSet {earliest_pt_end, m_song->points().cend()};
+            attained_act_ends.reset(earliest_pt_end, m_song->points().cend());
             lower_bound_set = true;
         }
-        complete_subpath(p, starting_pos, sp_bar, attained_act_ends, cache,
-                         best_score_boost, acts);
+        complete_subpath(p, starting_pos, sp_bar, attained_act_ends,
+                         pending.candidates);
     }
 
-    return {acts, best_score_boost};
+    return pending;
+}
+
+void Optimiser::set_checkpoint(std::string path, SightRead::Second interval)
+{
+    m_checkpoint_path = std::move(path);
+    m_checkpoint_interval = interval;
+}
+
+void Optimiser::set_max_memory(std::size_t max_bytes)
+{
+    m_max_memory = max_bytes;
+}
+
+// Every key of the common suffix is the same number of points from the end of
+// both songs, so entries are rebased by that distance. Evicted entries, and
+// entries whose activations were taken from a key before the suffix, are left
+// for the search to work out again.
+std::size_t Optimiser::reuse_memo(const Optimiser& previous)
+{
+    if (previous.m_drum_fill_delay.value() != m_drum_fill_delay.value()
+        || previous.m_whammy_delay.value() != m_whammy_delay.value()) {
+        return 0;
+    }
+    const auto suffix_length = static_cast<std::ptrdiff_t>(
+        m_song->common_suffix_length(*previous.m_song));
+    if (suffix_length == 0) {
+        return 0;
+    }
+
+    const auto& points = m_song->points();
+    const auto& old_points = previous.m_song->points();
+    const auto old_suffix_start = std::prev(old_points.cend(), suffix_length);
+    const auto rebase = [&](PointPtr point) {
+        return std::prev(points.cend(),
+                         std::distance(point, old_points.cend()));
+    };
+    const auto rebase_key = [&](CacheKey key) {
+        return CacheKey {rebase(key.point), key.position};
+    };
+    const auto rebase_value = [&](const CacheValue& value) {
+        CacheValue rebased_value {{}, value.score_boost, value.ties_truncated};
+        rebased_value.valid_until = value.valid_until;
+        rebased_value.possible_next_acts.reserve(
+            value.possible_next_acts.size());
+        for (const auto& [act, next_key] : value.possible_next_acts) {
+            rebased_value.possible_next_acts.emplace_back(
+                ProtoActivation {rebase(act.act_start), rebase(act.act_end)},
+                rebase_key(next_key));
+        }
+        if (value.source.has_value()) {
+            rebased_value.source = rebase_key(*value.source);
+        }
+        return rebased_value;
+    };
+    const auto is_reusable = [&](PointPtr point, const CacheValue& value) {
+        return point >= old_suffix_start && !value.is_evicted
+            && (!value.source.has_value()
+                || value.source->point >= old_suffix_start);
+    };
+
+    auto& cache = m_memo;
+    std::size_t reused_entries = 0;
+    for (const auto& [key, value] : previous.m_memo.paths) {
+        if (is_reusable(key.point, value)) {
+            add_to_cache(rebase_key(key), false, rebase_value(value), cache);
+            ++reused_entries;
+        }
+    }
+    for (const auto& [point, value] : previous.m_memo.full_sp_paths) {
+        if (is_reusable(point, value)) {
+            const auto new_point = rebase(point);
+            add_to_cache({new_point, std::prev(new_point)->hit_window_start},
+                         true, rebase_value(value), cache);
+            ++reused_entries;
+        }
+    }
+    return reused_entries;
+}
+
+Optimiser::CacheStats Optimiser::cache_stats() const
+{
+    return {m_evictions.load(), m_recomputations.load(),
+            m_peak_memo_bytes.load(), m_kept_memo_bytes.load(),
+            m_searched_keys.load()};
+}
+
+std::uint64_t Optimiser::checkpoint_fingerprint() const
+{
+    Fingerprint fingerprint;
+    m_song->add_to_fingerprint(fingerprint);
+    fingerprint.add(m_drum_fill_delay.value());
+    fingerprint.add(m_whammy_delay.value());
+    fingerprint.add(MAX_STORED_TIES);
+    return fingerprint.value();
+}
+
+void Optimiser::write_checkpoint_key(std::string& buffer, CacheKey key) const
+{
+    write_value(buffer,
+                static_cast<std::uint32_t>(
+                    std::distance(m_song->points().cbegin(), key.point)));
+    write_value(buffer, key.position.beat.value());
+    write_value(buffer, key.position.sp_measure.value());
+}
+
+// Returns an empty optional if the key can't be read or its point is out of
+// range. Keys can be at the end of the song, as next keys of the last
+// activations are.
+std::optional<Optimiser::CacheKey>
+Optimiser::read_checkpoint_key(std::istream& stream) const
+{
+    const auto& points = m_song->points();
+    std::uint32_t index = 0;
+    double beat = 0.0;
+    double measure = 0.0;
+    if (!read_value(stream, index) || !read_value(stream, beat)
+        || !read_value(stream, measure)
+        || index > std::distance(points.cbegin(), points.cend())) {
+        return std::nullopt;
+    }
+    return CacheKey {std::next(points.cbegin(), index),
+                     {SightRead::Beat(beat), SpMeasure(measure)}};
+}
+
+// Loads the entries of the checkpoint file into cache and returns the length
+// of the file up to the last complete record, or 0 if the file is missing or
+// is for a different song or settings.
+std::size_t Optimiser::read_checkpoint(Cache& cache) const
+{
+    std::ifstream file {m_checkpoint_path, std::ios::binary};
+    std::array<char, CHECKPOINT_MAGIC.size()> magic {};
+    std::uint64_t fingerprint = 0;
+    if (!file.read(magic.data(), magic.size()) || magic != CHECKPOINT_MAGIC
+        || !read_value(file, fingerprint)
+        || fingerprint != checkpoint_fingerprint()) {
+        return 0;
+    }
+
+    const auto& points = m_song->points();
+    auto valid_length = static_cast<std::size_t>(file.tellg());
+    while (true) {
+        std::uint8_t record_type = 0;
+        std::int32_t score_boost = 0;
+        double valid_until = 0.0;
+        std::uint8_t ties_truncated = 0;
+        std::uint8_t has_source = 0;
+        std::uint32_t act_count = 0;
+        if (!read_value(file, record_type)) {
+            break;
+        }
+        const auto key = read_checkpoint_key(file);
+        if (!key.has_value() || key->point == points.cend()) {
+            break;
+        }
+        if (record_type == VALID_UNTIL_RECORD) {
+            const auto entry = cache.paths.find(*key);
+            if (!read_value(file, valid_until) || entry == cache.paths.end()) {
+                break;
+            }
+            entry->second.valid_until = std::max(entry->second.valid_until,
+                                                 SightRead::Beat(valid_until));
+            valid_length = static_cast<std::size_t>(file.tellg());
+            continue;
+        }
+        if (!read_value(file, score_boost) || !read_value(file, valid_until)
+            || !read_value(file, ties_truncated)
+            || !read_value(file, has_source)) {
+            break;
+        }
+        CacheValue value {{}, score_boost, ties_truncated != 0};
+        value.valid_until = SightRead::Beat(valid_until);
+        if (has_source != 0) {
+            value.source = read_checkpoint_key(file);
+            if (!value.source.has_value()
+                || value.source->point == points.cend()) {
+                break;
+            }
+        }
+        if (!read_value(file, act_count)) {
+            break;
+        }
+        auto is_complete = true;
+        for (auto i = 0U; i < act_count; ++i) {
+            std::uint32_t act_start = 0;
+            std::uint32_t act_end = 0;
+            if (!read_value(file, act_start) || !read_value(file, act_end)
+                || act_start > act_end
+                || act_end >= std::distance(points.cbegin(), points.cend())) {
+                is_complete = false;
+                break;
+            }
+            const auto next_key = read_checkpoint_key(file);
+            if (!next_key.has_value()) {
+                is_complete = false;
+                break;
+            }
+            value.possible_next_acts.emplace_back(
+                ProtoActivation {std::next(points.cbegin(), act_start),
+                                 std::next(points.cbegin(), act_end)},
+                *next_key);
+        }
+        if (!is_complete) {
+            break;
+        }
+        add_to_cache(*key, record_type == FULL_SP_PATH_RECORD,
+                     std::move(value), cache);
+        valid_length = static_cast<std::size_t>(file.tellg());
+    }
+    return valid_length;
 }
 
-Path Optimiser::optimal_path() const
+// Resumes from the checkpoint file if it matches, otherwise starts a new one.
+// A record cut short by the last run being stopped mid-write is dropped, so
+// that new records follow on from the last complete one.
+void Optimiser::open_checkpoint(Cache& cache) const
 {
-    Cache cache;
-    CacheKey start_key {m_song->points().cbegin(),
-                        {SightRead::Beat(NEG_INF), SpMeasure(NEG_INF)}};
-    start_key = advance_cache_key(start_key);
+    if (m_checkpoint_path.empty()) {
+        return;
+    }
 
-    const auto best_score_boost = get_partial_path(start_key, cache);
-    Path path {{}, best_score_boost};
+    const auto valid_length = read_checkpoint(cache);
+    if (valid_length == 0) {
+        std::string header {CHECKPOINT_MAGIC.cbegin(), CHECKPOINT_MAGIC.cend()};
+        write_value(header, checkpoint_fingerprint());
+        std::ofstream file {m_checkpoint_path,
+                            std::ios::binary | std::ios::trunc};
+        file.write(header.data(), static_cast<std::streamsize>(header.size()));
+        if (!file) {
+            throw std::runtime_error("Could not write checkpoint to "
+                                     + m_checkpoint_path);
+        }
+    } else {
+        std::filesystem::resize_file(m_checkpoint_path, valid_length);
+    }
 
-    while (start_key.point != m_song->points().cend()) {
-        const auto& acts = cache.paths.at(start_key).possible_next_acts;
+    const std::chrono::duration<double> interval {
+        m_checkpoint_interval.value()};
+    cache.checkpoint = CheckpointState {
+        {},
+        std::chrono::steady_clock::now()
+            + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                interval),
+        {}};
+}
+
+// Adds an entry that is about to be cached to the checkpoint, and hands the
+// unsaved entries to a background write if one is due and the last one has
+// finished.
+void Optimiser::save_to_checkpoint(CacheKey key, bool has_full_sp,
+                                   const CacheValue& value, Cache& cache) const
+{
+    auto& checkpoint = *cache.checkpoint;
+    auto& buffer = checkpoint.unsaved_entries;
+    write_value(buffer, has_full_sp ? FULL_SP_PATH_RECORD : PATH_RECORD);
+    write_checkpoint_key(buffer, key);
+    write_value(buffer, static_cast<std::int32_t>(value.score_boost));
+    write_value(buffer, value.valid_until.value());
+    write_value(buffer, static_cast<std::uint8_t>(value.ties_truncated));
+    write_value(buffer, static_cast<std::uint8_t>(value.source.has_value()));
+    if (value.source.has_value()) {
+        write_checkpoint_key(buffer, *value.source);
+    }
+    write_value(buffer,
+                static_cast<std::uint32_t>(value.possible_next_acts.size()));
+    const auto& points = m_song->points();
+    for (const auto& [act, next_key] : value.possible_next_acts) {
+        write_value(buffer, static_cast<std::uint32_t>(std::distance(
+                                points.cbegin(), act.act_start)));
+        write_value(buffer, static_cast<std::uint32_t>(
+                                std::distance(points.cbegin(), act.act_end)));
+        write_checkpoint_key(buffer, next_key);
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    if (now < checkpoint.next_write) {
+        return;
+    }
+    if (checkpoint.pending_write.valid()) {
+        if (checkpoint.pending_write.wait_for(std::chrono::seconds(0))
+            != std::future_status::ready) {
+            return;
+        }
+        checkpoint.pending_write.get();
+    }
+    checkpoint.pending_write
+        = std::async(std::launch::async, append_to_file, m_checkpoint_path,
+                     std::exchange(buffer, {}));
+    const std::chrono::duration<double> interval {
+        m_checkpoint_interval.value()};
+    checkpoint.next_write
+        = now + std::chrono::duration_cast<decltype(now)::duration>(interval);
+}
+
+// Records that the entry for key, which is already in the checkpoint, now
+// holds up to valid_until. It is written out with the next entry.
+void Optimiser::save_valid_until_to_checkpoint(CacheKey key,
+                                               SightRead::Beat valid_until,
+                                               Cache& cache) const
+{
+    auto& buffer = cache.checkpoint->unsaved_entries;
+    write_value(buffer, VALID_UNTIL_RECORD);
+    write_checkpoint_key(buffer, key);
+    write_value(buffer, valid_until.value());
+}
+
+// Waits for any background write, writes out the remaining entries and stops
+// recording new ones, so that queries after a search do not add to the
+// checkpoint. The next search to open it picks up from here.
+void Optimiser::close_checkpoint(Cache& cache) const
+{
+    if (!cache.checkpoint.has_value()) {
+        return;
+    }
+
+    auto& checkpoint = *cache.checkpoint;
+    if (checkpoint.pending_write.valid()) {
+        checkpoint.pending_write.get();
+    }
+    if (!checkpoint.unsaved_entries.empty()) {
+        append_to_file(m_checkpoint_path,
+                       std::exchange(checkpoint.unsaved_entries, {}));
+    }
+    cache.checkpoint.reset();
+}
+
+Optimiser::CacheKey Optimiser::initial_key() const
+{
+    return advance_cache_key({m_song->points().cbegin(),
+                              {SightRead::Beat(NEG_INF), SpMeasure(NEG_INF)}});
+}
+
+// Works out the best subpaths from key, where the bar need not be empty,
+// searching any later keys they need first.
+Optimiser::CacheValue Optimiser::resolve_from(CacheKey key, Cache& cache,
+                                              double initial_sp) const
+{
+    const auto pending = find_best_subpaths(key, false, initial_sp);
+    for (const auto& candidate : pending.candidates) {
+        get_partial_path(candidate.next_key, cache);
+    }
+    if (pending.full_sp_point.has_value()) {
+        const auto point = *pending.full_sp_point;
+        get_partial_path({point, std::prev(point)->hit_window_start}, cache,
+                         std::nullopt, true);
+    }
+    return resolve_subpaths(pending, cache);
+}
+
+// Returns the activations of the best subpaths from key, which must be worked
+// out already. If key only lies in the interval of an earlier entry, they are
+// taken from that entry's as try_previous_best_subpaths would, or worked out
+// afresh if none of those are possible from key.
+std::vector<std::tuple<ProtoActivation, Optimiser::CacheKey>>
+Optimiser::cached_acts(CacheKey key, Cache& cache) const
+{
+    const auto entry = covering_entry(key, cache);
+    assert(entry != cache.paths.end()); // NOLINT
+    const auto& [entry_key, value] = *entry;
+    auto acts = value.is_evicted ? recompute_acts(entry_key, cache)
+                                 : value.possible_next_acts;
+    if (entry_key.position.beat == key.position.beat) {
+        return acts;
+    }
+    if (!value.ties_truncated) {
+        acts = acts_still_possible(acts, key);
+        if (!acts.empty()) {
+            return acts;
+        }
+    }
+    auto resolved_value = resolve_from(key, cache);
+    bound_ties(resolved_value, key);
+    return std::move(resolved_value.possible_next_acts);
+}
+
+// Appends the activations of the best path from key, which must be worked out
+// already.
+void Optimiser::choose_cached_acts(CacheKey key, Cache& cache,
+                                   std::vector<ChosenAct>& chosen_acts) const
+{
+    while (key.point != m_song->points().cend()) {
+        const auto acts = cached_acts(key, cache);
         // We can get here if the song ends in say ES1.
         if (acts.empty()) {
             break;
         }
-        auto best_proto_act = std::get<0>(acts[0]);
-        auto best_next_key = std::get<1>(acts[0]);
-        auto best_sqz_level = act_squeeze_level(best_proto_act, start_key);
-        for (auto i = 1U; i < acts.size(); ++i) {
-            const auto [proto_act, next_key] = acts[i];
-            const auto sqz_level = act_squeeze_level(proto_act, start_key);
-            if (sqz_level < best_sqz_level) {
-                best_proto_act = std::get<0>(acts[i]);
-                best_next_key = std::get<1>(acts[i]);
-                best_sqz_level = sqz_level;
+        const auto [best_index, best_sqz_level] = best_tie(acts, key);
+        const auto& [best_proto_act, best_next_key] = acts[best_index];
+        chosen_acts.push_back({best_proto_act, key, best_sqz_level});
+        key = best_next_key;
+    }
+}
+
+// Picking each activation depends on the one before, but once they are picked,
+// the whammy and activation bounds of each can be found on its own.
+std::vector<Activation>
+Optimiser::build_activations(const std::vector<ChosenAct>& chosen_acts) const
+{
+    const auto chunks = map_chunks(
+        chosen_acts.size(), MIN_ACTS_PER_TASK,
+        [&](std::size_t begin, std::size_t end) {
+            std::vector<Activation> activations;
+            activations.reserve(end - begin);
+            for (auto i = begin; i < end; ++i) {
+                activations.push_back(build_activation(chosen_acts[i]));
             }
-        }
-        const auto min_whammy_force
-            = forced_whammy_end(best_proto_act, start_key, best_sqz_level);
-        const auto [start_pos, end_pos] = act_duration(
-            best_proto_act, start_key, best_sqz_level, min_whammy_force);
-        Activation act {best_proto_act.act_start, best_proto_act.act_end,
-                        min_whammy_force.beat, start_pos, end_pos};
-        path.activations.push_back(act);
-        start_key = best_next_key;
+            return activations;
+        });
+
+    std::vector<Activation> activations;
+    activations.reserve(chosen_acts.size());
+    for (const auto& chunk : chunks) {
+        activations.insert(activations.end(), chunk.cbegin(), chunk.cend());
+    }
+    return activations;
+}
+
+// Runs the full search, returning the key it starts from. Entries already in
+// cache are used as they are.
+Optimiser::CacheKey Optimiser::solve(Cache& cache) const
+{
+    const auto start_key = initial_key();
+    if (covering_entry(start_key, cache) != cache.paths.end()) {
+        return start_key;
+    }
+    open_checkpoint(cache);
+    get_partial_path(start_key, cache);
+    close_checkpoint(cache);
+    return start_key;
+}
+
+// Returns the score of the best path from key, working it out first if the
+// search skipped it.
+int Optimiser::cached_score(CacheKey key, Cache& cache) const
+{
+    if (key.point == m_song->points().cend()) {
+        return 0;
+    }
+    auto entry = covering_entry(key, cache);
+    if (entry == cache.paths.end()) {
+        get_partial_path(key, cache);
+        entry = covering_entry(key, cache);
+    }
+    return entry->second.score_boost;
+}
+
+// Returns the score of the best path from point with full SP, which is at
+// least the score of every activation the full SP searches from point on can
+// lead to.
+int Optimiser::full_sp_score(PointPtr point, Cache& cache) const
+{
+    auto entry = cache.full_sp_paths.find(point);
+    if (entry == cache.full_sp_paths.end()) {
+        get_partial_path({point, std::prev(point)->hit_window_start}, cache,
+                         std::nullopt, true);
+        entry = cache.full_sp_paths.find(point);
+    }
+    return entry->second.score_boost;
+}
+
+Path Optimiser::optimal_path()
+{
+    auto& cache = m_memo;
+    const auto start_key = solve(cache);
+
+    Path path {{}, 0};
+    if (start_key.point == m_song->points().cend()) {
+        return path;
     }
+    path.score_boost = covering_entry(start_key, cache)->second.score_boost;
+
+    std::vector<ChosenAct> chosen_acts;
+    choose_cached_acts(start_key, cache, chosen_acts);
+    path.activations = build_activations(chosen_acts);
 
     return path;
 }
 
-double Optimiser::act_squeeze_level(ProtoActivation act, CacheKey key) const
+Path Optimiser::best_path_from(std::size_t point_index, double sp,
+                               SpPosition position)
 {
-    constexpr double THRESHOLD = 0.01;
+    const auto& points = m_song->points();
+    if (point_index > static_cast<std::size_t>(
+            std::distance(points.cbegin(), points.cend()))) {
+        throw std::invalid_argument("Point index out of range");
+    }
+    if (sp < 0.0 || sp > 1.0) {
+        throw std::invalid_argument("SP should lie between 0.0 and 1.0");
+    }
+    auto& cache = m_memo;
+    solve(cache);
+
+    const CacheKey key {std::next(points.cbegin(),
+                                  static_cast<std::ptrdiff_t>(point_index)),
+                        position};
+    Path path {{}, 0};
+    if (key.point == points.cend()) {
+        return path;
+    }
+
+    // The state is not a key of the memo, since the bar need not be empty, so
+    // only the keys its activations lead to are looked up.
+    const auto value = resolve_from(key, cache, sp);
+    path.score_boost = value.score_boost;
+    if (value.possible_next_acts.empty()) {
+        return path;
+    }
+
+    const auto [best_index, best_sqz_level]
+        = best_tie(value.possible_next_acts, key, sp);
+    const auto& [best_proto_act, best_next_key]
+        = value.possible_next_acts[best_index];
+    std::vector<ChosenAct> chosen_acts {
+        {best_proto_act, key, best_sqz_level, sp}};
+    choose_cached_acts(best_next_key, cache, chosen_acts);
+    path.activations = build_activations(chosen_acts);
+    return path;
+}
+
+// Every path is the optimal path with some activations swapped for others
+// from the same key, each followed by the best path from where it leads. So
+// the paths are worked out best first by finishing the best unfinished path,
+// then adding each path that differs from it by one more swap after its last.
+// Each path is only finished once, so no path is added twice.
+//
+// The activations of the full SP searches a key's search stops at are not
+// added one by one. Each search is added as a single path scored by the
+// memo's full SP score at its point, which no activation from it can beat,
+// and is only searched once that is the best unfinished path. Most of them
+// never are, so few of the searches the memo made are made again.
+std::vector<Path> Optimiser::best_paths(std::size_t count)
+{
+    auto& cache = m_memo;
+    const auto start_key = solve(cache);
+
+    // Paths that differ by one swap only differ from one another in a single
+    // activation, so for each start and end only the best next key is kept.
+    const auto best_per_act = [&](PendingSubpaths pending) {
+        std::vector<SubpathCandidate> best_candidates;
+        std::map<std::tuple<PointPtr, PointPtr>, std::size_t> indices;
+        for (auto& candidate : pending.candidates) {
+            const auto [index, is_new] = indices.emplace(
+                std::tuple {candidate.act.act_start, candidate.act.act_end},
+                best_candidates.size());
+            if (is_new) {
+                best_candidates.push_back(candidate);
+                continue;
+            }
+            auto& best_candidate = best_candidates[index->second];
+            if (cached_score(candidate.next_key, cache)
+                > cached_score(best_candidate.next_key, cache)) {
+                best_candidate = candidate;
+            }
+        }
+        pending.candidates = std::move(best_candidates);
+        return pending;
+    };
+    std::map<CacheKey, PendingSubpaths> key_swaps;
+    const auto swaps_from = [&](CacheKey key) -> const auto& {
+        auto swaps = key_swaps.find(key);
+        if (swaps == key_swaps.end()) {
+            if (m_terminate->load()) {
+                throw std::runtime_error("Thread halted");
+            }
+            swaps = key_swaps
+                        .emplace(key,
+                                 best_per_act(find_best_subpaths(key, false)))
+                        .first;
+        }
+        return swaps->second;
+    };
+    std::map<PointPtr, PendingSubpaths> full_sp_swaps;
+    const auto full_sp_swaps_from = [&](PointPtr point) -> const auto& {
+        auto swaps = full_sp_swaps.find(point);
+        if (swaps == full_sp_swaps.end()) {
+            if (m_terminate->load()) {
+                throw std::runtime_error("Thread halted");
+            }
+            const CacheKey full_sp_key {point,
+                                        std::prev(point)->hit_window_start};
+            swaps = full_sp_swaps
+                        .emplace(point, best_per_act(find_best_subpaths(
+                                            full_sp_key, true)))
+                        .first;
+        }
+        return swaps->second;
+    };
+
+    const auto is_worse = [](const auto& lhs, const auto& rhs) {
+        return lhs.score < rhs.score;
+    };
+    std::priority_queue<AlternativePath, std::vector<AlternativePath>,
+                        decltype(is_worse)>
+        unfinished {is_worse};
+    unfinished.push({cached_score(start_key, cache), std::nullopt, start_key,
+                     std::nullopt});
+    std::vector<AlternativeNode> nodes;
+    std::set<std::vector<std::tuple<PointPtr, PointPtr>>> seen_paths;
+    std::vector<Path> paths;
+
+    // Adds the paths that follow parent with a swap from key to one of swaps,
+    // other than skipped_act, where prefix_score is the score of the path up
+    // to key.
+    const auto add_swaps = [&](const PendingSubpaths& swaps,
+                               std::optional<std::size_t> parent, CacheKey key,
+                               int prefix_score,
+                               std::optional<ProtoActivation> skipped_act) {
+        for (const auto& [act, next_key, act_score] : swaps.candidates) {
+            if (skipped_act.has_value()
+                && act.act_start == skipped_act->act_start
+                && act.act_end == skipped_act->act_end) {
+                continue;
+            }
+            nodes.push_back({{act, key, 0.0}, parent});
+            unfinished.push(
+                {prefix_score + act_score + cached_score(next_key, cache),
+                 nodes.size() - 1, next_key, std::nullopt});
+        }
+        if (swaps.full_sp_point.has_value()) {
+            const auto point = *swaps.full_sp_point;
+            unfinished.push({prefix_score + full_sp_score(point, cache), parent,
+                             key, point});
+        }
+    };
+
+    while (paths.size() < count && !unfinished.empty()) {
+        const auto alternative = unfinished.top();
+        unfinished.pop();
+        if (alternative.full_sp_point.has_value()) {
+            const auto point = *alternative.full_sp_point;
+            add_swaps(full_sp_swaps_from(point), alternative.last_node,
+                      alternative.key,
+                      alternative.score - full_sp_score(point, cache),
+                      std::nullopt);
+            continue;
+        }
+
+        // The squeeze level of a swapped in activation is only worked out once
+        // its path is finished, as most unfinished paths never are.
+        if (alternative.last_node.has_value()) {
+            auto& last_act = nodes[*alternative.last_node].act;
+            const std::vector<std::tuple<ProtoActivation, CacheKey>> acts {
+                {last_act.act, alternative.key}};
+            last_act.sqz_level = std::get<1>(best_tie(acts, last_act.key));
+        }
+        std::vector<ChosenAct> chosen_acts;
+        for (auto node = alternative.last_node; node.has_value();
+             node = nodes[*node].parent) {
+            chosen_acts.push_back(nodes[*node].act);
+        }
+        std::reverse(chosen_acts.begin(), chosen_acts.end());
+        const auto prefix_size = chosen_acts.size();
+        choose_cached_acts(alternative.key, cache, chosen_acts);
+
+        std::vector<std::tuple<PointPtr, PointPtr>> path_acts;
+        path_acts.reserve(chosen_acts.size());
+        for (const auto& chosen_act : chosen_acts) {
+            path_acts.emplace_back(chosen_act.act.act_start,
+                                   chosen_act.act.act_end);
+        }
+        if (!seen_paths.insert(std::move(path_acts)).second) {
+            continue;
+        }
+        paths.push_back({build_activations(chosen_acts), alternative.score});
+
+        auto parent = alternative.last_node;
+        for (auto i = prefix_size;
+             i < chosen_acts.size() && paths.size() < count; ++i) {
+            const auto& chosen_act = chosen_acts[i];
+            const auto key = chosen_act.key;
+            add_swaps(swaps_from(key), parent, key,
+                      alternative.score - cached_score(key, cache),
+                      chosen_act.act);
+            nodes.push_back({chosen_act, parent});
+            parent = nodes.size() - 1;
+        }
+    }
+
+    return paths;
+}
+
+// Returns the candidate activations from key, without needing any later
+// scores. A search with a full bar stops at the point after the next SP
+// granting note, where waiting on with a full bar is searched from afresh, so
+// the searches are followed from point to point to the end of the song. They
+// are kept in full_sp_searches, as many keys lead to the same ones.
+std::vector<Optimiser::SubpathCandidate>
+Optimiser::step_candidates(CacheKey key,
+                           FullSpSearches& full_sp_searches) const
+{
+    if (m_terminate->load()) {
+        throw std::runtime_error("Thread halted");
+    }
+    auto pending = find_best_subpaths(key, false);
+    auto& candidates = pending.candidates;
+    auto full_sp_point = pending.full_sp_point;
+    while (full_sp_point.has_value()) {
+        const auto point = *full_sp_point;
+        auto search = full_sp_searches.find(point);
+        if (search == full_sp_searches.end()) {
+            const CacheKey full_sp_key {point,
+                                        std::prev(point)->hit_window_start};
+            search = full_sp_searches
+                         .emplace(point, find_best_subpaths(full_sp_key, true))
+                         .first;
+        }
+        const auto& full_sp_candidates = search->second.candidates;
+        candidates.insert(candidates.end(), full_sp_candidates.cbegin(),
+                          full_sp_candidates.cend());
+        full_sp_point = search->second.full_sp_point;
+    }
+    return std::move(candidates);
+}
+
+// Finds a path quickly by taking, from each key, the candidate activation with
+// the most points per point it moves the path on by.
+std::vector<Optimiser::GreedyStep> Optimiser::greedy_steps(CacheKey key) const
+{
+    const auto& points = m_song->points();
+    FullSpSearches full_sp_searches;
+    std::vector<GreedyStep> steps;
+    while (key.point != points.cend()) {
+        const auto candidates = step_candidates(key, full_sp_searches);
+        if (candidates.empty()) {
+            break;
+        }
 
-    auto min_sqz = 0.0;
-    auto max_sqz = 1.0;
+        const auto rate = [&](const SubpathCandidate& candidate) {
+            const auto distance
+                = std::distance(key.point, candidate.next_key.point);
+            return candidate.act_score
+                / static_cast<double>(
+                       std::max(distance, decltype(distance) {1}));
+        };
+        const auto best = std::max_element(
+            candidates.cbegin(), candidates.cend(),
+            [&](const auto& x, const auto& y) { return rate(x) < rate(y); });
+        steps.push_back({key, *best});
+        key = best->next_key;
+    }
+    return steps;
+}
+
+Optimiser::AnytimePath Optimiser::best_path_within(SightRead::Second time_limit)
+{
+    using Clock = std::chrono::steady_clock;
+    const std::chrono::duration<double> limit {time_limit.value()};
+    const auto deadline
+        = Clock::now() + std::chrono::duration_cast<Clock::duration>(limit);
+    const auto start_key = initial_key();
+    const auto steps = greedy_steps(start_key);
+
+    auto& cache = m_memo;
+    open_checkpoint(cache);
+    const auto is_optimal = get_partial_path(start_key, cache, deadline);
+    close_checkpoint(cache);
+
+    // The search works out later keys first, so the greedy path can be cut
+    // short at any of its keys the search has finished with and completed
+    // with the best path from there. The earliest cut wins ties, so a finished
+    // search gives the optimal path.
+    auto best_score = -1;
+    std::size_t best_cut = 0;
+    auto cut_key = start_key;
+    auto prefix_score = 0;
+    for (auto i = 0U; i <= steps.size(); ++i) {
+        if (i > 0) {
+            cut_key = steps[i - 1].candidate.next_key;
+            prefix_score += steps[i - 1].candidate.act_score;
+        }
+        std::optional<int> rest_score;
+        if (cut_key.point == m_song->points().cend()) {
+            rest_score = 0;
+        } else if (const auto entry = covering_entry(cut_key, cache);
+                   entry != cache.paths.end()) {
+            rest_score = entry->second.score_boost;
+        } else if (i == steps.size()) {
+            rest_score = 0;
+        }
+        if (rest_score.has_value() && prefix_score + *rest_score > best_score) {
+            best_score = prefix_score + *rest_score;
+            best_cut = i;
+        }
+    }
+
+    std::vector<ChosenAct> chosen_acts;
+    for (auto i = 0U; i < best_cut; ++i) {
+        const auto& [key, candidate] = steps[i];
+        chosen_acts.push_back(
+            {candidate.act, key, act_squeeze_level(candidate.act, key)});
+    }
+    const auto rest_key
+        = best_cut == 0 ? start_key : steps[best_cut - 1].candidate.next_key;
+    if (rest_key.point != m_song->points().cend()
+        && covering_entry(rest_key, cache) != cache.paths.end()) {
+        choose_cached_acts(rest_key, cache, chosen_acts);
+    }
+
+    return {{build_activations(chosen_acts), best_score}, is_optimal};
+}
+
+// Returns the index and squeeze level of the activation in acts with the lowest
+// squeeze level from key, the earliest one on equal squeeze. Squeeze levels
+// are found concurrently when there are enough ties, and a bisection is cut
+// short once it is known to lose to the best level found so far.
+std::tuple<std::size_t, double> Optimiser::best_tie(
+    const std::vector<std::tuple<ProtoActivation, CacheKey>>& acts,
+    CacheKey key, double initial_sp) const
+{
+    constexpr double POS_INF = std::numeric_limits<double>::infinity();
+
+    std::atomic<double> best_level {POS_INF};
+    const auto chunk_bests = map_chunks(
+        acts.size(), MIN_TIES_PER_TASK,
+        [&](std::size_t begin, std::size_t end) {
+            std::tuple<std::size_t, double> chunk_best {begin, POS_INF};
+            for (auto i = begin; i < end; ++i) {
+                const auto sqz_level
+                    = act_squeeze_level(std::get<0>(acts[i]), key,
+                                        best_level.load(), initial_sp);
+                if (sqz_level < std::get<1>(chunk_best)) {
+                    chunk_best = {i, sqz_level};
+                    lower_to(best_level, sqz_level);
+                }
+            }
+            return chunk_best;
+        });
+
+    auto best = chunk_bests.front();
+    for (const auto& chunk_best : chunk_bests) {
+        if (std::get<1>(chunk_best) < std::get<1>(best)) {
+            best = chunk_best;
+        }
+    }
+    return best;
+}
+
+Activation Optimiser::build_activation(const ChosenAct& chosen_act) const
+{
+    const auto& [act, key, sqz_level, initial_sp] = chosen_act;
+    const auto min_whammy_force
+        = forced_whammy_end(act, key, sqz_level, initial_sp);
+    const auto [start_pos, end_pos]
+        = act_duration(act, key, sqz_level, min_whammy_force, initial_sp);
+    return {act.act_start, act.act_end, min_whammy_force.beat, start_pos,
+            end_pos};
+}
+
+// Returns the result of trying act from key at the given squeeze, starting as
+// early as that squeeze allows.
+ActResult Optimiser::squeezed_act_result(ProtoActivation act, CacheKey key,
+                                         double sqz_level,
+                                         double initial_sp) const
+{
     // Determines what point controls how early we can go: the previous point on
     // guitar and the current point on drums.
     const auto start_bound_point
         = m_song->is_drums() ? act.act_start : std::prev(act.act_start);
-    while (max_sqz - min_sqz > THRESHOLD) {
-        auto trial_sqz = (min_sqz + max_sqz) / 2;
-        auto start_pos
-            = m_song->adjusted_hit_window_start(start_bound_point, trial_sqz);
-        if (start_pos.beat < key.position.beat) {
-            start_pos = key.position;
-        }
+    auto start_pos
+        = m_song->adjusted_hit_window_start(start_bound_point, sqz_level);
+    if (start_pos.beat < key.position.beat) {
+        start_pos = key.position;
+    }
 
-        const auto& [sp_bar, new_pos]
-            = m_song->total_available_sp_with_earliest_pos(
-                key.position.beat, key.point, act.act_start, start_pos);
-        start_pos = new_pos;
+    const auto& [sp_bar, new_pos]
+        = m_song->total_available_sp_with_earliest_pos(
+            key.position.beat, key.point, act.act_start, start_pos,
+            initial_sp);
 
-        ActivationCandidate candidate {act.act_start, act.act_end, start_pos,
-                                       sp_bar};
-        if (m_song->is_candidate_valid(candidate, trial_sqz).validity
-            == ActValidity::success) {
-            max_sqz = trial_sqz;
-        } else {
-            min_sqz = trial_sqz;
+    ActivationCandidate candidate {act.act_start, act.act_end, new_pos, sp_bar};
+    return m_song->is_candidate_valid(candidate, sqz_level);
+}
+
+// The search stops early once the lowest level the result can be is at least
+// cutoff, as then it cannot beat cutoff.
+double Optimiser::act_squeeze_level(ProtoActivation act, CacheKey key,
+                                    double cutoff, double initial_sp) const
+{
+    const auto cells = bisection_cells(1.0, SQZ_THRESHOLD);
+    const auto level = [&](std::uint32_t i) {
+        if (i == 0) {
+            return 0.0;
         }
-    }
-    return max_sqz;
+        return i == cells ? 1.0 : bisection_point(0.0, 1.0, i, cells);
+    };
+    const auto stop = static_cast<std::uint32_t>(
+        std::min(std::ceil(std::max(cutoff, 0.0) * cells),
+                 static_cast<double>(cells)));
+    const auto trial = [&](std::uint32_t i) {
+        return squeezed_act_result(act, key, level(i), initial_sp);
+    };
+    const auto is_finished = [&](std::uint32_t low, std::uint32_t high) {
+        return !(level(high) - level(low) > SQZ_THRESHOLD)
+            || level(low) >= cutoff;
+    };
+    const auto bracket
+        = find_outcome_change(cells, true, trial, is_finished, stop);
+    const auto sqz_level = level(std::get<1>(bracket));
+    assert(sqz_level // NOLINT
+           == level(std::get<1>(
+               bisect_outcome_change(cells, true, trial, is_finished))));
+    return sqz_level;
 }
 
 SpPosition Optimiser::forced_whammy_end(ProtoActivation act, CacheKey key,
-                                        double sqz_level) const
+                                        double sqz_level,
+                                        double initial_sp) const
 {
     constexpr double POS_INF = std::numeric_limits<double>::infinity();
     constexpr double THRESHOLD = 0.01;
@@ -413,33 +1824,48 @@ SpPosition Optimiser::forced_whammy_end(ProtoActivation act, CacheKey key,
     }
 
     auto prev_point = std::prev(act.act_start);
-    auto min_whammy_force = key.position;
-    auto max_whammy_force = next_point->hit_window_end;
+    const auto min_whammy_force = key.position;
+    const auto max_whammy_force = next_point->hit_window_end;
+    const auto whammy_width = max_whammy_force.beat - min_whammy_force.beat;
+    // One level finer than the bisection's cells, since its stopping test is
+    // on the rounded ends of its bracket rather than the halved width.
+    const auto cells = 2 * bisection_cells(whammy_width.value(), THRESHOLD);
+    const auto whammy_force = [&](std::uint32_t i) -> SpPosition {
+        if (i == 0) {
+            return min_whammy_force;
+        }
+        if (i == cells) {
+            return max_whammy_force;
+        }
+        const auto beat = bisection_point(min_whammy_force.beat,
+                                          max_whammy_force.beat, i, cells);
+        return {beat, m_song->sp_time_map().to_sp_measures(beat)};
+    };
     auto start_pos = m_song->adjusted_hit_window_start(prev_point, sqz_level);
-    while ((max_whammy_force.beat - min_whammy_force.beat).value()
-           > THRESHOLD) {
-        auto mid_beat
-            = (min_whammy_force.beat + max_whammy_force.beat) * (1.0 / 2);
-        auto mid_meas = m_song->sp_time_map().to_sp_measures(mid_beat);
-        SpPosition mid_pos {mid_beat, mid_meas};
+    const auto trial = [&](std::uint32_t i) {
+        const auto whammy_end = whammy_force(i);
         auto sp_bar = m_song->total_available_sp(key.position.beat, key.point,
-                                                 act.act_start, mid_beat);
+                                                 act.act_start,
+                                                 whammy_end.beat, initial_sp);
         ActivationCandidate candidate {act.act_start, act.act_end, start_pos,
                                        sp_bar};
-        auto result = m_song->is_candidate_valid(candidate, sqz_level, mid_pos);
-        if (result.validity == ActValidity::success) {
-            min_whammy_force = mid_pos;
-        } else {
-            max_whammy_force = mid_pos;
-        }
-    }
+        return m_song->is_candidate_valid(candidate, sqz_level, whammy_end);
+    };
 
-    return min_whammy_force;
+    const auto is_finished = [&](std::uint32_t low, std::uint32_t high) {
+        return !((whammy_force(high).beat - whammy_force(low).beat).value()
+                 > THRESHOLD);
+    };
+    const auto bracket
+        = find_outcome_change(cells, false, trial, is_finished, cells);
+    assert(bracket // NOLINT
+           == bisect_outcome_change(cells, false, trial, is_finished));
+    return whammy_force(std::get<0>(bracket));
 }
 
 std::tuple<SightRead::Beat, SightRead::Beat>
 Optimiser::act_duration(ProtoActivation act, CacheKey key, double sqz_level,
-                        SpPosition min_whammy_force) const
+                        SpPosition min_whammy_force, double initial_sp) const
 {
     constexpr double THRESHOLD = 0.01;
 
@@ -447,29 +1873,42 @@ Optimiser::act_duration(ProtoActivation act, CacheKey key, double sqz_level,
     // guitar and the current point on drums.
     const auto start_bound_point
         = m_song->is_drums() ? act.act_start : std::prev(act.act_start);
-    auto min_pos
+    const auto min_pos
         = m_song->adjusted_hit_window_start(start_bound_point, sqz_level);
-    auto max_pos = m_song->adjusted_hit_window_end(act.act_start, sqz_level);
-    auto sp_bar = m_song->total_available_sp(
-        key.position.beat, key.point, act.act_start, min_whammy_force.beat);
-    while ((max_pos.beat - min_pos.beat).value() > THRESHOLD) {
-        auto trial_beat = (min_pos.beat + max_pos.beat) * (1.0 / 2);
-        auto trial_meas = m_song->sp_time_map().to_sp_measures(trial_beat);
-        SpPosition trial_pos {trial_beat, trial_meas};
-        ActivationCandidate candidate {act.act_start, act.act_end, trial_pos,
-                                       sp_bar};
-        if (m_song->is_candidate_valid(candidate, sqz_level, min_whammy_force)
-                .validity
-            == ActValidity::success) {
-            min_pos = trial_pos;
-        } else {
-            max_pos = trial_pos;
+    const auto max_pos
+        = m_song->adjusted_hit_window_end(act.act_start, sqz_level);
+    const auto start_width = max_pos.beat - min_pos.beat;
+    // As in forced_whammy_end, one level finer than the bisection's cells.
+    const auto cells = 2 * bisection_cells(start_width.value(), THRESHOLD);
+    const auto start = [&](std::uint32_t i) -> SpPosition {
+        if (i == 0) {
+            return min_pos;
         }
-    }
+        if (i == cells) {
+            return max_pos;
+        }
+        const auto beat = bisection_point(min_pos.beat, max_pos.beat, i, cells);
+        return {beat, m_song->sp_time_map().to_sp_measures(beat)};
+    };
+    auto sp_bar = m_song->total_available_sp(key.position.beat, key.point,
+                                             act.act_start,
+                                             min_whammy_force.beat, initial_sp);
+    const auto trial = [&](std::uint32_t i) {
+        ActivationCandidate candidate {act.act_start, act.act_end, start(i),
+                                       sp_bar};
+        return m_song->is_candidate_valid(candidate, sqz_level,
+                                          min_whammy_force);
+    };
 
-    ActivationCandidate candidate {act.act_start, act.act_end, min_pos, sp_bar};
-    auto result
-        = m_song->is_candidate_valid(candidate, sqz_level, min_whammy_force);
+    const auto is_finished = [&](std::uint32_t low, std::uint32_t high) {
+        return !((start(high).beat - start(low).beat).value() > THRESHOLD);
+    };
+    const auto bracket
+        = find_outcome_change(cells, false, trial, is_finished, cells);
+    assert(bracket // NOLINT
+           == bisect_outcome_change(cells, false, trial, is_finished));
+    const auto start_pos = start(std::get<0>(bracket));
+    auto result = trial(std::get<0>(bracket));
     assert(result.validity == ActValidity::success); // NOLINT
-    return {min_pos.beat, result.ending_position.beat};
+    return {start_pos.beat, result.ending_position.beat};
 }
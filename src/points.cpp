@@ -22,7 +22,9 @@
 #include <cmath>
 #include <cstdint>
 #include <iterator>
+#include <stdexcept>
 #include <type_traits>
+#include <utility>
 
 #include "points.hpp"
 
@@ -36,7 +38,8 @@ bool phrase_contains_pos(const SightRead::StarPower& phrase,
     return position < (phrase.position + phrase.length);
 }
 
-double song_tick_gap(int resolution, const Engine& engine)
+template <typename EngineType>
+double song_tick_gap(int resolution, const EngineType& engine)
 {
     double quotient
         = resolution / static_cast<double>(engine.sust_points_per_beat());
@@ -46,11 +49,11 @@ double song_tick_gap(int resolution, const Engine& engine)
     return std::max(quotient, 1.0);
 }
 
-template <typename OutputIt>
+template <typename OutputIt, typename EngineType>
 void append_sustain_points(OutputIt points, SightRead::Tick position,
                            SightRead::Tick sust_length, int resolution,
                            int chord_size, const SpTimeMap& time_map,
-                           const Engine& engine)
+                           const EngineType& engine)
 {
     constexpr double HALF_RES_OFFSET = 0.5;
 
@@ -73,20 +76,24 @@ void append_sustain_points(OutputIt points, SightRead::Tick position,
         sust_ticks *= chord_size;
     }
 
-    while (float_sust_len > engine.burst_size() * resolution
-           && sust_ticks > 0) {
+    const auto burst_length = engine.burst_size() * resolution;
+    while (float_sust_len > burst_length && sust_ticks > 0) {
         float_pos += tick_gap;
         float_sust_len -= tick_gap;
         const SightRead::Beat beat {(float_pos - HALF_RES_OFFSET) / float_res};
         const auto meas = time_map.to_sp_measures(beat);
+        const auto seconds = time_map.to_seconds(beat);
         --sust_ticks;
-        *points++ = {{beat, meas}, {beat, meas}, {beat, meas}, {}, 1, 1,
-                     true,         false,        false};
+        *points++ = {{beat, meas}, {beat, meas}, {beat, meas}, seconds, seconds,
+                     seconds,      {},           1,            1,       true,
+                     false,        false};
     }
     if (sust_ticks > 0) {
         const SightRead::Beat beat {(float_pos + HALF_RES_OFFSET) / float_res};
         const auto meas = time_map.to_sp_measures(beat);
-        *points++ = {{beat, meas}, {beat, meas}, {beat, meas}, {},   sust_ticks,
+        const auto seconds = time_map.to_seconds(beat);
+        *points++ = {{beat, meas}, {beat, meas}, {beat, meas}, seconds,
+                     seconds,      seconds,      {},           sust_ticks,
                      sust_ticks,   true,         false,        false};
     }
 }
@@ -106,13 +113,13 @@ int get_chord_size(const SightRead::Note& note,
     return note_count;
 }
 
-template <typename OutputIt>
+template <typename OutputIt, typename EngineType>
 void append_note_points(std::vector<SightRead::Note>::const_iterator note,
                         const std::vector<SightRead::Note>& notes,
                         OutputIt points, const SpTimeMap& time_map,
                         int resolution, bool is_note_sp_ender,
                         bool is_unison_sp_ender, double squeeze,
-                        const Engine& engine,
+                        const EngineType& engine,
                         const SightRead::DrumSettings& drum_settings)
 {
     auto note_value = engine.base_note_value();
@@ -150,14 +157,24 @@ void append_note_points(std::vector<SightRead::Note>::const_iterator note,
     const SightRead::Second late_window {
         engine.late_timing_window(early_gap, late_gap) * squeeze};
 
-    const auto early_beat = time_map.to_beats(note_seconds - early_window);
+    const auto early_seconds = note_seconds - early_window;
+    const auto early_beat = time_map.to_beats(early_seconds);
     const auto early_meas = time_map.to_sp_measures(early_beat);
-    const auto late_beat = time_map.to_beats(note_seconds + late_window);
+    const auto late_seconds = note_seconds + late_window;
+    const auto late_beat = time_map.to_beats(late_seconds);
     const auto late_meas = time_map.to_sp_measures(late_beat);
-    *points++
-        = {{beat, meas}, {early_beat, early_meas}, {late_beat, late_meas},
-           {},           note_value * chord_size,  note_value * chord_size,
-           false,        is_note_sp_ender,         is_unison_sp_ender};
+    *points++ = {{beat, meas},
+                 {early_beat, early_meas},
+                 {late_beat, late_meas},
+                 note_seconds,
+                 early_seconds,
+                 late_seconds,
+                 {},
+                 note_value * chord_size,
+                 note_value * chord_size,
+                 false,
+                 is_note_sp_ender,
+                 is_unison_sp_ender};
 
     SightRead::Tick min_length {std::numeric_limits<int>::max()};
     SightRead::Tick max_length {0};
@@ -182,13 +199,17 @@ void append_note_points(std::vector<SightRead::Note>::const_iterator note,
     }
 }
 
+// Returns the point closest to fill_end, searching forward from start. Since
+// the closest point only moves forward as fill_end does, searches for fills in
+// order can each start from the previous result.
 std::vector<Point>::iterator closest_point(std::vector<Point>& points,
+                                           std::vector<Point>::iterator start,
                                            SightRead::Beat fill_end)
 {
-    assert(!points.empty()); // NOLINT
-    auto nearest = points.begin();
+    assert(start != points.end()); // NOLINT
+    auto nearest = start;
     auto best_gap = std::abs((nearest->position.beat - fill_end).value());
-    for (auto p = std::next(points.begin()); p < points.end(); ++p) {
+    for (auto p = std::next(start); p < points.end(); ++p) {
         if (p->position.beat <= nearest->position.beat) {
             continue;
         }
@@ -209,11 +230,19 @@ void add_drum_activation_points(const SightRead::NoteTrack& track,
         return;
     }
     const auto& tempo_map = track.global_data().tempo_map();
+    auto search_start = points.begin();
+    SightRead::Beat previous_fill_end {
+        -std::numeric_limits<double>::infinity()};
     for (auto fill : track.drum_fills()) {
         const auto fill_start = tempo_map.to_beats(fill.position);
         const auto fill_end = tempo_map.to_beats(fill.position + fill.length);
-        const auto best_point = closest_point(points, fill_end);
+        if (fill_end < previous_fill_end) {
+            search_start = points.begin();
+        }
+        const auto best_point = closest_point(points, search_start, fill_end);
         best_point->fill_start = tempo_map.to_seconds(fill_start);
+        search_start = best_point;
+        previous_fill_end = fill_end;
     }
 }
 
@@ -221,8 +250,7 @@ void shift_points_by_video_lag(std::vector<Point>& points,
                                const SpTimeMap& time_map,
                                SightRead::Second video_lag)
 {
-    const auto add_video_lag = [&](auto& position) {
-        auto seconds = time_map.to_seconds(position.beat);
+    const auto add_video_lag = [&](auto& position, auto& seconds) {
         seconds += video_lag;
         position.beat = time_map.to_beats(seconds);
         position.sp_measure = time_map.to_sp_measures(position.beat);
@@ -232,24 +260,29 @@ void shift_points_by_video_lag(std::vector<Point>& points,
         if (point.is_hold_point) {
             continue;
         }
-        add_video_lag(point.position);
-        add_video_lag(point.hit_window_start);
-        add_video_lag(point.hit_window_end);
+        add_video_lag(point.position, point.position_seconds);
+        add_video_lag(point.hit_window_start, point.hit_window_start_seconds);
+        add_video_lag(point.hit_window_end, point.hit_window_end_seconds);
     }
 }
 
 template <typename P>
-std::vector<PointPtr> next_matching_vector(const std::vector<Point>& points,
-                                           P predicate)
+std::vector<std::uint32_t>
+next_matching_vector(const std::vector<Point>& points, P predicate)
 {
     if (points.empty()) {
         return {};
     }
-    std::vector<PointPtr> next_matching_points;
-    auto next_matching_point = points.cend();
+    // The entry for cend() is included, so callers can step past the last
+    // point.
+    std::vector<std::uint32_t> next_matching_points;
+    next_matching_points.reserve(points.size() + 1);
+    auto next_matching_point = static_cast<std::uint32_t>(points.size());
+    next_matching_points.push_back(next_matching_point);
     for (auto p = std::prev(points.cend());; --p) {
         if (predicate(*p)) {
-            next_matching_point = p;
+            next_matching_point
+                = static_cast<std::uint32_t>(std::distance(points.cbegin(), p));
         }
         next_matching_points.push_back(next_matching_point);
         // We can't have the loop condition be p >= points.cbegin() because
@@ -279,7 +312,8 @@ std::string to_guitar_colour_string(
     return colour_string;
 }
 
-void apply_multiplier(std::vector<Point>& points, const Engine& engine)
+template <typename EngineType>
+void apply_multiplier(std::vector<Point>& points, const EngineType& engine)
 {
     constexpr int COMBO_PER_MULTIPLIER_LEVEL = 10;
 
@@ -318,17 +352,20 @@ bool is_note_skippable(const SightRead::Note& starting_note,
     return starting_note.position == note_to_test.position;
 }
 
+template <typename EngineType>
 std::vector<Point> unmultiplied_points(
     const SightRead::NoteTrack& track, const SpTimeMap& time_map,
     const std::vector<SightRead::Tick>& unison_phrases,
     const SqueezeSettings& squeeze_settings,
-    const SightRead::DrumSettings& drum_settings, const Engine& engine)
+    const SightRead::DrumSettings& drum_settings, const EngineType& engine)
 {
     const auto& notes = track.notes();
     const auto bre = track.bre();
 
     std::vector<Point> points;
     auto current_phrase = track.sp_phrases().cbegin();
+    auto sorted_unison_phrases = unison_phrases;
+    std::sort(sorted_unison_phrases.begin(), sorted_unison_phrases.end());
 
     for (auto p = notes.cbegin(); p != notes.cend();) {
         if (track.track_type() == SightRead::TrackType::Drums) {
@@ -343,7 +380,7 @@ std::vector<Point> unmultiplied_points(
         const auto search_start
             = has_split_notes(track.track_type()) ? std::next(p) : p;
         const auto q = std::find_if_not(
-            search_start, notes.cend(), [=](const auto& note) {
+            search_start, notes.cend(), [&](const auto& note) {
                 return is_note_skippable(*p, note, track.track_type(),
                                          drum_settings);
             });
@@ -355,9 +392,9 @@ std::vector<Point> unmultiplied_points(
                 || !phrase_contains_pos(*current_phrase, q->position))) {
             is_note_sp_ender = true;
             if (engine.has_unison_bonuses()
-                && std::find(unison_phrases.cbegin(), unison_phrases.cend(),
-                             current_phrase->position)
-                    != unison_phrases.cend()) {
+                && std::binary_search(sorted_unison_phrases.cbegin(),
+                                      sorted_unison_phrases.cend(),
+                                      current_phrase->position)) {
                 is_unison_sp_ender = true;
             }
             ++current_phrase;
@@ -369,18 +406,24 @@ std::vector<Point> unmultiplied_points(
         p = q;
     }
 
-    std::stable_sort(points.begin(), points.end(),
-                     [](const auto& x, const auto& y) {
-                         return x.position.beat < y.position.beat;
-                     });
+    // Points only come out of order when a sustain runs past later notes, so
+    // most tracks can skip the sort entirely.
+    const auto by_position = [](const auto& x, const auto& y) {
+        return x.position.beat < y.position.beat;
+    };
+    if (!std::is_sorted(points.cbegin(), points.cend(), by_position)) {
+        std::stable_sort(points.begin(), points.end(), by_position);
+    }
 
     return points;
 }
 
+template <typename EngineType>
 std::vector<Point>
 non_drum_points(const SightRead::NoteTrack& track, const SpTimeMap& time_map,
                 const std::vector<SightRead::Tick>& unison_phrases,
-                const SqueezeSettings& squeeze_settings, const Engine& engine)
+                const SqueezeSettings& squeeze_settings,
+                const EngineType& engine)
 {
     auto points = unmultiplied_points(
         track, time_map, unison_phrases, squeeze_settings,
@@ -435,12 +478,16 @@ std::string colours_string(const SightRead::Note& note)
     return colours;
 }
 
-std::vector<PointPtr>
+std::vector<std::uint32_t>
 first_after_current_sp_vector(const std::vector<Point>& points,
                               const SightRead::NoteTrack& track,
                               const Engine& engine)
 {
-    std::vector<PointPtr> results;
+    const auto index_of = [&](auto p) {
+        return static_cast<std::uint32_t>(std::distance(points.cbegin(), p));
+    };
+    std::vector<std::uint32_t> results;
+    results.reserve(points.size());
     const auto& tempo_map = track.global_data().tempo_map();
     auto current_sp = track.sp_phrases().cbegin();
     for (auto p = points.cbegin(); p < points.cend();) {
@@ -457,43 +504,61 @@ first_after_current_sp_vector(const std::vector<Point>& points,
                 = tempo_map.to_beats(current_sp->position + current_sp->length);
         }
         if (p->position.beat < sp_start || engine.overlaps()) {
-            results.push_back(++p);
+            results.push_back(index_of(++p));
             continue;
         }
         const auto q = std::find_if(std::next(p), points.cend(), [&](auto pt) {
             return pt.position.beat >= sp_end;
         });
         while (p < q) {
-            results.push_back(q);
+            results.push_back(index_of(q));
             ++p;
         }
     }
     return results;
 }
 
-std::vector<std::string> note_colours(const std::vector<SightRead::Note>& notes,
-                                      const std::vector<Point>& points)
+// Returns the distinct colour sets of the points, and the index of each
+// point's colour set in that list. Hold points have the empty colour set, which
+// is always first.
+std::tuple<std::vector<std::string>, std::vector<std::uint16_t>>
+note_colours(const std::vector<SightRead::Note>& notes,
+             const std::vector<Point>& points)
 {
-    std::vector<std::string> colours;
-    colours.reserve(points.size());
+    std::vector<std::string> names {""};
+    std::vector<std::uint16_t> ids;
+    ids.reserve(points.size());
     auto note_ptr = notes.cbegin();
     for (const auto& p : points) {
         if (p.is_hold_point) {
-            colours.emplace_back("");
+            ids.push_back(0);
             continue;
         }
-        colours.push_back(colours_string(*note_ptr));
+        auto colours = colours_string(*note_ptr);
         ++note_ptr;
+        auto name = std::find(names.cbegin(), names.cend(), colours);
+        if (name == names.cend()) {
+            if (names.size() > std::numeric_limits<std::uint16_t>::max()) {
+                throw std::runtime_error("Too many distinct colour sets");
+            }
+            names.push_back(std::move(colours));
+            name = std::prev(names.cend());
+        }
+        ids.push_back(
+            static_cast<std::uint16_t>(std::distance(names.cbegin(), name)));
     }
-    return colours;
+    return {names, ids};
 }
 
+// This is instantiated for each concrete engine through visit_engine, so the
+// per-note and per-tick engine queries are not virtual calls.
+template <typename EngineType>
 std::vector<Point>
 points_from_track(const SightRead::NoteTrack& track, const SpTimeMap& time_map,
                   const std::vector<SightRead::Tick>& unison_phrases,
                   const SqueezeSettings& squeeze_settings,
                   const SightRead::DrumSettings& drum_settings,
-                  const Engine& engine)
+                  const EngineType& engine)
 {
     if (track.track_type() != SightRead::TrackType::Drums) {
         return non_drum_points(track, time_map, unison_phrases,
@@ -507,18 +572,25 @@ points_from_track(const SightRead::NoteTrack& track, const SpTimeMap& time_map,
     return points;
 }
 
-std::vector<PointPtr> next_non_hold_vector(const std::vector<Point>& points)
+std::vector<std::uint32_t>
+next_non_hold_vector(const std::vector<Point>& points)
 {
     return next_matching_vector(points,
                                 [](const auto& p) { return !p.is_hold_point; });
 }
 
-std::vector<PointPtr> next_sp_note_vector(const std::vector<Point>& points)
+std::vector<std::uint32_t> next_sp_note_vector(const std::vector<Point>& points)
 {
     return next_matching_vector(
         points, [](const auto& p) { return p.is_sp_granting_note; });
 }
 
+std::vector<std::uint32_t> next_fill_vector(const std::vector<Point>& points)
+{
+    return next_matching_vector(
+        points, [](const auto& p) { return p.fill_start.has_value(); });
+}
+
 std::vector<int> score_totals(const std::vector<Point>& points)
 {
     std::vector<int> scores;
@@ -553,47 +625,54 @@ PointSet::PointSet(const SightRead::NoteTrack& track, const SpTimeMap& time_map,
                    const SqueezeSettings& squeeze_settings,
                    const SightRead::DrumSettings& drum_settings,
                    const Engine& engine)
-    : m_points {points_from_track(track, time_map, unison_phrases,
-                                  squeeze_settings, drum_settings, engine)}
+    : m_points {visit_engine(engine, [&](const auto& concrete_engine) {
+        auto points = points_from_track(track, time_map, unison_phrases,
+                                        squeeze_settings, drum_settings,
+                                        concrete_engine);
+        // The lookup tables below hold point indices as std::uint32_t.
+        if (points.size() >= std::numeric_limits<std::uint32_t>::max()) {
+            throw std::runtime_error("Too many points in track");
+        }
+        return points;
+    })}
     , m_first_after_current_sp {first_after_current_sp_vector(m_points, track,
                                                               engine)}
     , m_next_non_hold_point {next_non_hold_vector(m_points)}
     , m_next_sp_granting_note {next_sp_note_vector(m_points)}
+    , m_next_fill_point {next_fill_vector(m_points)}
     , m_solo_boosts {solo_boosts_from_solos(track.solos(drum_settings),
                                             time_map)}
     , m_cumulative_score_totals {score_totals(m_points)}
     , m_video_lag {squeeze_settings.video_lag}
-    , m_colours {note_colours(track.notes(), m_points)}
 {
+    std::tie(m_colour_names, m_colour_ids)
+        = note_colours(track.notes(), m_points);
 }
 
 PointPtr PointSet::first_after_current_phrase(PointPtr point) const
 {
-    const auto index
-        = static_cast<std::size_t>(std::distance(m_points.cbegin(), point));
-    return m_first_after_current_sp[index];
+    return std::next(m_points.cbegin(),
+                     m_first_after_current_sp[index_of(point)]);
 }
 
 PointPtr PointSet::next_non_hold_point(PointPtr point) const
 {
-    const auto index
-        = static_cast<std::size_t>(std::distance(m_points.cbegin(), point));
-    return m_next_non_hold_point[index];
+    return std::next(m_points.cbegin(), m_next_non_hold_point[index_of(point)]);
 }
 
 PointPtr PointSet::next_sp_granting_note(PointPtr point) const
 {
-    const auto index
-        = static_cast<std::size_t>(std::distance(m_points.cbegin(), point));
-    return m_next_sp_granting_note[index];
+    return std::next(m_points.cbegin(),
+                     m_next_sp_granting_note[index_of(point)]);
+}
+
+PointPtr PointSet::next_fill_point(PointPtr point) const
+{
+    return std::next(m_points.cbegin(), m_next_fill_point[index_of(point)]);
 }
 
 int PointSet::range_score(PointPtr start, PointPtr end) const
 {
-    const auto start_index
-        = static_cast<std::size_t>(std::distance(m_points.cbegin(), start));
-    const auto end_index
-        = static_cast<std::size_t>(std::distance(m_points.cbegin(), end));
-    return m_cumulative_score_totals[end_index]
-        - m_cumulative_score_totals[start_index];
+    return m_cumulative_score_totals[index_of(end)]
+        - m_cumulative_score_totals[index_of(start)];
 }
@@ -16,10 +16,13 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstdint>
 #include <iomanip>
 #include <iterator>
+#include <limits>
 #include <sstream>
 
 #include "processed.hpp"
@@ -84,9 +87,11 @@ ProcessedSong::ProcessedSong(const SightRead::NoteTrack& track,
 
 SpBar ProcessedSong::total_available_sp(
     SightRead::Beat start, PointPtr first_point, PointPtr act_start,
-    SightRead::Beat required_whammy_end) const
+    SightRead::Beat required_whammy_end, double initial_sp) const
 {
     auto sp_bar = sp_from_phrases(first_point, act_start);
+    sp_bar.min() = std::min(sp_bar.min() + initial_sp, 1.0);
+    sp_bar.max() = std::min(sp_bar.max() + initial_sp, 1.0);
 
     if (start >= required_whammy_end) {
         sp_bar.max()
@@ -112,11 +117,11 @@ SpBar ProcessedSong::total_available_sp(
 std::tuple<SpBar, SpPosition>
 ProcessedSong::total_available_sp_with_earliest_pos(
     SightRead::Beat start, PointPtr first_point, PointPtr act_start,
-    SpPosition earliest_potential_pos) const
+    SpPosition earliest_potential_pos, double initial_sp) const
 {
-    const SightRead::Beat BEAT_EPSILON {0.0001};
-
     auto sp_bar = sp_from_phrases(first_point, act_start);
+    sp_bar.min() = std::min(sp_bar.min() + initial_sp, 1.0);
+    sp_bar.max() = std::min(sp_bar.max() + initial_sp, 1.0);
 
     sp_bar.max() += m_sp_data.available_whammy(
         start, earliest_potential_pos.beat, act_start->position.beat);
@@ -127,31 +132,42 @@ ProcessedSong::total_available_sp_with_earliest_pos(
     }
 
     const auto extra_sp_required = m_minimum_sp_to_activate - sp_bar.max();
-    auto first_beat = earliest_potential_pos.beat;
-    auto last_beat = act_start->position.beat;
-    if (m_sp_data.available_whammy(first_beat, last_beat,
+    const auto last_beat = act_start->position.beat;
+    if (m_sp_data.available_whammy(earliest_potential_pos.beat, last_beat,
                                    act_start->position.beat)
         < extra_sp_required) {
         return {sp_bar, earliest_potential_pos};
     }
 
-    while (last_beat - first_beat > BEAT_EPSILON) {
-        const auto mid_beat = (first_beat + last_beat) * 0.5;
+    const auto earliest_beat = m_sp_data.whammy_end_for_sp(
+        earliest_potential_pos.beat, last_beat, act_start->position.beat,
+        extra_sp_required);
+#ifndef NDEBUG
+    // Check the solved beat against the bisection it replaced.
+    const SightRead::Beat BEAT_EPSILON {0.0001};
+    auto first_bisect_beat = earliest_potential_pos.beat;
+    auto last_bisect_beat = last_beat;
+    while (last_bisect_beat - first_bisect_beat > BEAT_EPSILON) {
+        const auto mid_beat = (first_bisect_beat + last_bisect_beat) * 0.5;
         if (m_sp_data.available_whammy(earliest_potential_pos.beat, mid_beat,
                                        act_start->position.beat)
             < extra_sp_required) {
-            first_beat = mid_beat;
+            first_bisect_beat = mid_beat;
         } else {
-            last_beat = mid_beat;
+            last_bisect_beat = mid_beat;
         }
     }
+    assert(earliest_beat >= first_bisect_beat - BEAT_EPSILON); // NOLINT
+    assert(earliest_beat <= last_bisect_beat + BEAT_EPSILON); // NOLINT
+#endif
 
-    sp_bar.max() += m_sp_data.available_whammy(
-        earliest_potential_pos.beat, last_beat, act_start->position.beat);
-    sp_bar.max() = std::min(sp_bar.max(), 1.0);
+    // By construction exactly the SP needed has been gained by earliest_beat;
+    // setting it directly keeps rounding from leaving the bar just short.
+    sp_bar.max() = std::min(m_minimum_sp_to_activate, 1.0);
 
     return {sp_bar,
-            SpPosition {last_beat, m_time_map.to_sp_measures(last_beat)}};
+            SpPosition {earliest_beat,
+                        m_time_map.to_sp_measures(earliest_beat)}};
 }
 
 SpPosition ProcessedSong::adjusted_hit_window_start(PointPtr point,
@@ -162,12 +178,16 @@ SpPosition ProcessedSong::adjusted_hit_window_start(PointPtr point,
     if (squeeze == 1.0) {
         return point->hit_window_start;
     }
+    // Hold points have a zero-width window, so only notes need interpolating.
+    if (squeeze == 0.0 || point->is_hold_point) {
+        return point->position;
+    }
 
-    auto start = m_time_map.to_seconds(point->hit_window_start.beat);
-    auto mid = m_time_map.to_seconds(point->position.beat);
-    auto adj_start_s = start + (mid - start) * (1.0 - squeeze);
-    auto adj_start_b = m_time_map.to_beats(adj_start_s);
-    auto adj_start_m = m_time_map.to_sp_measures(adj_start_b);
+    const auto start = point->hit_window_start_seconds;
+    const auto mid = point->position_seconds;
+    const auto adj_start_s = start + (mid - start) * (1.0 - squeeze);
+    const auto adj_start_b = m_time_map.to_beats(adj_start_s);
+    const auto adj_start_m = m_time_map.to_sp_measures(adj_start_b);
 
     return {adj_start_b, adj_start_m};
 }
@@ -180,28 +200,192 @@ SpPosition ProcessedSong::adjusted_hit_window_end(PointPtr point,
     if (squeeze == 1.0) {
         return point->hit_window_end;
     }
+    if (squeeze == 0.0 || point->is_hold_point) {
+        return point->position;
+    }
 
-    auto mid = m_time_map.to_seconds(point->position.beat);
-    auto end = m_time_map.to_seconds(point->hit_window_end.beat);
-    auto adj_end_s = mid + (end - mid) * squeeze;
-    auto adj_end_b = m_time_map.to_beats(adj_end_s);
-    auto adj_end_m = m_time_map.to_sp_measures(adj_end_b);
+    const auto mid = point->position_seconds;
+    const auto end = point->hit_window_end_seconds;
+    const auto adj_end_s = mid + (end - mid) * squeeze;
+    const auto adj_end_b = m_time_map.to_beats(adj_end_s);
+    const auto adj_end_m = m_time_map.to_sp_measures(adj_end_b);
 
     return {adj_end_b, adj_end_m};
 }
 
-class SpStatus {
+void ProcessedSong::add_to_fingerprint(Fingerprint& fingerprint) const
+{
+    fingerprint.add(m_minimum_sp_to_activate);
+    fingerprint.add(m_is_drums);
+    fingerprint.add(m_overlaps);
+    m_time_map.add_to_fingerprint(fingerprint);
+    const auto add_position = [&](const SpPosition& position) {
+        fingerprint.add(position.beat.value());
+        fingerprint.add(position.sp_measure.value());
+    };
+    for (auto p = m_points.cbegin(); p < m_points.cend(); ++p) {
+        const auto& point = *p;
+        add_position(point.position);
+        add_position(point.hit_window_start);
+        add_position(point.hit_window_end);
+        fingerprint.add(point.position_seconds.value());
+        fingerprint.add(point.hit_window_start_seconds.value());
+        fingerprint.add(point.hit_window_end_seconds.value());
+        fingerprint.add(point.fill_start.has_value());
+        if (point.fill_start.has_value()) {
+            fingerprint.add(point.fill_start->value());
+        }
+        fingerprint.add(point.value);
+        fingerprint.add(point.base_value);
+        fingerprint.add(point.is_hold_point);
+        fingerprint.add(point.is_sp_granting_note);
+        fingerprint.add(point.is_unison_sp_granting_note);
+    }
+    m_sp_data.add_to_fingerprint(fingerprint);
+}
+
+std::size_t
+ProcessedSong::common_suffix_length(const ProcessedSong& other) const
+{
+    if (m_minimum_sp_to_activate != other.m_minimum_sp_to_activate
+        || m_is_drums != other.m_is_drums || m_overlaps != other.m_overlaps) {
+        return 0;
+    }
+
+    const auto same_position = [](const auto& lhs, const auto& rhs) {
+        return lhs.beat.value() == rhs.beat.value()
+            && lhs.sp_measure.value() == rhs.sp_measure.value();
+    };
+    const auto same_point = [&](const Point& lhs, const Point& rhs) {
+        return same_position(lhs.position, rhs.position)
+            && same_position(lhs.hit_window_start, rhs.hit_window_start)
+            && same_position(lhs.hit_window_end, rhs.hit_window_end)
+            && lhs.position_seconds.value() == rhs.position_seconds.value()
+            && lhs.hit_window_start_seconds.value()
+            == rhs.hit_window_start_seconds.value()
+            && lhs.hit_window_end_seconds.value()
+            == rhs.hit_window_end_seconds.value()
+            && lhs.fill_start.has_value() == rhs.fill_start.has_value()
+            && (!lhs.fill_start.has_value()
+                || lhs.fill_start->value() == rhs.fill_start->value())
+            && lhs.value == rhs.value && lhs.base_value == rhs.base_value
+            && lhs.is_hold_point == rhs.is_hold_point
+            && lhs.is_sp_granting_note == rhs.is_sp_granting_note
+            && lhs.is_unison_sp_granting_note
+            == rhs.is_unison_sp_granting_note;
+    };
+
+    auto p = m_points.cend();
+    auto q = other.m_points.cend();
+    while (p != m_points.cbegin() && q != other.m_points.cbegin()
+           && same_point(*std::prev(p), *std::prev(q))) {
+        --p;
+        --q;
+    }
+    if (p == m_points.cend()) {
+        return 0;
+    }
+
+    // Results from a point depend on the start of the timing window of the
+    // point before, which is the earliest they can gain SP from, and on the
+    // whammy from there on.
+    const auto whammy_match_start = m_sp_data.matches_from(other.m_sp_data);
+    ++p;
+    while (p != m_points.cend()
+           && std::prev(p)->hit_window_start.beat < whammy_match_start) {
+        ++p;
+    }
+    return static_cast<std::size_t>(std::distance(p, m_points.cend()));
+}
+
+// Bounds how far an activation from each point can go. With an activation
+// starting at p and ending at q, at most a full bar, the phrases from p up to
+// q and the whammy between p's hit window end and q's hit window start can be
+// spent on the drain between those two positions. Everything is measured from
+// the first point, so with reach[q] the drain to q less the SP that can be
+// gained before q, q is out of reach once reach[q] is more than a bar past the
+// same quantity at p. Taking the minimum of reach over every later point makes
+// it nondecreasing, so the limit for each point is found by a binary search.
+std::vector<std::uint32_t> ProcessedSong::act_end_limits() const
+{
+    constexpr double MEASURES_PER_BAR = 8.0;
+    constexpr double SP_PHRASE_AMOUNT = 0.25;
+    // Leaves room for rounding in is_candidate_valid's SP propagation.
+    constexpr double SP_EPSILON = 1e-6;
+
+    const auto point_count = static_cast<std::size_t>(
+        std::distance(m_points.cbegin(), m_points.cend()));
+    if (point_count == 0) {
+        return {};
+    }
+
+    // Hit windows are not always in order, so whammy is totted up as a signed
+    // amount between consecutive positions.
+    auto whammy_position = m_points.cbegin()->hit_window_start.beat;
+    auto whammy_total = 0.0;
+    const auto whammy_up_to = [&](SightRead::Beat beat) {
+        if (beat >= whammy_position) {
+            whammy_total += m_sp_data.available_whammy(whammy_position, beat);
+        } else {
+            whammy_total -= m_sp_data.available_whammy(beat, whammy_position);
+        }
+        whammy_position = beat;
+        return whammy_total;
+    };
+
+    std::vector<double> reach;
+    std::vector<double> start_reach;
+    reach.reserve(point_count);
+    start_reach.reserve(point_count);
+    auto phrase_total = 0.0;
+    for (auto p = m_points.cbegin(); p < m_points.cend(); ++p) {
+        const auto drain_to_start
+            = p->hit_window_start.sp_measure.value() / MEASURES_PER_BAR;
+        const auto drain_to_end
+            = p->hit_window_end.sp_measure.value() / MEASURES_PER_BAR;
+        if (!m_overlaps) {
+            reach.push_back(drain_to_start);
+            start_reach.push_back(drain_to_end);
+            continue;
+        }
+        reach.push_back(drain_to_start - phrase_total
+                        - whammy_up_to(p->hit_window_start.beat));
+        start_reach.push_back(drain_to_end - phrase_total
+                              - whammy_up_to(p->hit_window_end.beat));
+        if (p->is_sp_granting_note) {
+            phrase_total += SP_PHRASE_AMOUNT;
+            if (p->is_unison_sp_granting_note) {
+                phrase_total += SP_PHRASE_AMOUNT;
+            }
+        }
+    }
+
+    for (auto i = point_count - 1; i > 0; --i) {
+        reach[i - 1] = std::min(reach[i - 1], reach[i]);
+    }
+
+    std::vector<std::uint32_t> limits;
+    limits.reserve(point_count);
+    for (auto i = 0U; i < point_count; ++i) {
+        const auto limit = std::upper_bound(std::next(reach.cbegin(), i + 1),
+                                            reach.cend(),
+                                            start_reach[i] + 1.0 + SP_EPSILON);
+        limits.push_back(
+            static_cast<std::uint32_t>(std::distance(reach.cbegin(), limit)));
+    }
+    return limits;
+}
+
+template <bool Overlaps> class SpStatus {
 private:
     SpPosition m_position;
     double m_sp;
-    bool m_overlap_engine;
     static constexpr double MEASURES_PER_BAR = 8.0;
 
 public:
-    SpStatus(SpPosition position, double sp, bool overlap_engine)
+    SpStatus(SpPosition position, double sp)
         : m_position {position}
         , m_sp {sp}
-        , m_overlap_engine {overlap_engine}
     {
     }
 
@@ -216,10 +400,9 @@ public:
         m_sp = std::min(m_sp, 1.0);
     }
 
-    void advance_whammy_max(SpPosition end_position, const SpData& sp_data,
-                            bool does_overlap)
+    void advance_whammy_max(SpPosition end_position, const SpData& sp_data)
     {
-        if (does_overlap) {
+        if constexpr (Overlaps) {
             m_sp = sp_data.propagate_sp_over_whammy_max(m_position,
                                                         end_position, m_sp);
         } else {
@@ -232,7 +415,7 @@ public:
     void update_early_end(SpPosition sp_note_start, const SpData& sp_data,
                           SpPosition required_whammy_end)
     {
-        if (!m_overlap_engine) {
+        if constexpr (!Overlaps) {
             required_whammy_end = {SightRead::Beat {0.0}, SpMeasure {0.0}};
         }
         m_sp = sp_data.propagate_sp_over_whammy_min(m_position, sp_note_start,
@@ -243,19 +426,19 @@ public:
     }
 
     void update_late_end(SpPosition sp_note_start, SpPosition sp_note_end,
-                         const SpData& sp_data, bool does_overlap)
+                         const SpData& sp_data)
     {
         if (sp_note_start.beat < m_position.beat) {
             sp_note_start = m_position;
         }
 
-        advance_whammy_max(sp_note_start, sp_data, does_overlap);
+        advance_whammy_max(sp_note_start, sp_data);
         if (m_sp < 0.0) {
             return;
         }
         // We might run out of SP between sp_note_start and sp_note_end. In this
         // case we just hit the note as early as possible.
-        if (does_overlap) {
+        if constexpr (Overlaps) {
             const auto new_sp = sp_data.propagate_sp_over_whammy_max(
                 sp_note_start, sp_note_end, m_sp);
             if (new_sp >= 0.0) {
@@ -270,12 +453,27 @@ ActResult
 ProcessedSong::is_candidate_valid(const ActivationCandidate& activation,
                                   double squeeze,
                                   SpPosition required_whammy_end) const
+{
+    if (m_overlaps) {
+        return is_candidate_valid_impl<true>(activation, squeeze,
+                                             required_whammy_end);
+    }
+    return is_candidate_valid_impl<false>(activation, squeeze,
+                                          required_whammy_end);
+}
+
+template <bool Overlaps>
+ActResult
+ProcessedSong::is_candidate_valid_impl(const ActivationCandidate& activation,
+                                       double squeeze,
+                                       SpPosition required_whammy_end) const
 {
     static constexpr double MEASURES_PER_BAR = 8.0;
     const SpPosition null_position {SightRead::Beat(0.0), SpMeasure(0.0)};
 
     if (!activation.sp_bar.full_enough_to_activate(m_minimum_sp_to_activate)) {
-        return {null_position, ActValidity::insufficient_sp};
+        return {null_position, ActValidity::insufficient_sp,
+                activation.sp_bar.max() - m_minimum_sp_to_activate};
     }
 
     auto ending_pos = adjusted_hit_window_start(activation.act_end, squeeze);
@@ -296,11 +494,11 @@ ProcessedSong::is_candidate_valid(const ActivationCandidate& activation,
                                       activation.act_start->position.beat);
     late_end_sp = std::min(late_end_sp, 1.0);
 
-    SpStatus status_for_early_end {
+    SpStatus<Overlaps> status_for_early_end {
         activation.earliest_activation_point,
-        std::max(activation.sp_bar.min(), m_minimum_sp_to_activate),
-        m_overlaps};
-    SpStatus status_for_late_end {late_end_position, late_end_sp, m_overlaps};
+        std::max(activation.sp_bar.min(), m_minimum_sp_to_activate)};
+    SpStatus<Overlaps> status_for_late_end {late_end_position, late_end_sp};
+    auto sp_margin = std::numeric_limits<double>::infinity();
 
     for (auto p = m_points.next_sp_granting_note(activation.act_start);
          p < activation.act_end;
@@ -313,14 +511,15 @@ ProcessedSong::is_candidate_valid(const ActivationCandidate& activation,
         if (p_end.beat > ending_pos.beat) {
             p_end = ending_pos;
         }
-        status_for_late_end.update_late_end(p_start, p_end, m_sp_data,
-                                            m_overlaps);
+        status_for_late_end.update_late_end(p_start, p_end, m_sp_data);
         if (status_for_late_end.sp() < 0.0) {
-            return {null_position, ActValidity::insufficient_sp};
+            return {null_position, ActValidity::insufficient_sp,
+                    status_for_late_end.sp()};
         }
+        sp_margin = std::min(sp_margin, status_for_late_end.sp());
         status_for_early_end.update_early_end(p_start, m_sp_data,
                                               required_whammy_end);
-        if (m_overlaps) {
+        if constexpr (Overlaps) {
             status_for_early_end.add_phrase();
             status_for_late_end.add_phrase();
             if (p->is_unison_sp_granting_note) {
@@ -330,31 +529,40 @@ ProcessedSong::is_candidate_valid(const ActivationCandidate& activation,
         }
     }
 
-    status_for_late_end.advance_whammy_max(ending_pos, m_sp_data, m_overlaps);
+    status_for_late_end.advance_whammy_max(ending_pos, m_sp_data);
     if (status_for_late_end.sp() < 0.0) {
-        return {null_position, ActValidity::insufficient_sp};
+        return {null_position, ActValidity::insufficient_sp,
+                status_for_late_end.sp()};
     }
+    sp_margin = std::min(sp_margin, status_for_late_end.sp());
 
     status_for_early_end.update_early_end(ending_pos, m_sp_data,
                                           required_whammy_end);
-    if (m_overlaps && activation.act_end->is_sp_granting_note) {
-        status_for_early_end.add_phrase();
-        if (activation.act_end->is_unison_sp_granting_note) {
+    if constexpr (Overlaps) {
+        if (activation.act_end->is_sp_granting_note) {
             status_for_early_end.add_phrase();
+            if (activation.act_end->is_unison_sp_granting_note) {
+                status_for_early_end.add_phrase();
+            }
         }
     }
     const auto end_meas = status_for_early_end.position().sp_measure
         + SpMeasure(status_for_early_end.sp() * MEASURES_PER_BAR);
 
     const auto next_point = std::next(activation.act_end);
-    if (next_point != m_points.cend()
-        && end_meas
-            >= adjusted_hit_window_end(next_point, squeeze).sp_measure) {
-        return {null_position, ActValidity::surplus_sp};
+    if (next_point != m_points.cend()) {
+        const auto next_point_end
+            = adjusted_hit_window_end(next_point, squeeze).sp_measure;
+        const auto surplus_margin
+            = (next_point_end - end_meas).value() / MEASURES_PER_BAR;
+        if (end_meas >= next_point_end) {
+            return {null_position, ActValidity::surplus_sp, surplus_margin};
+        }
+        sp_margin = std::min(sp_margin, surplus_margin);
     }
 
     const auto end_beat = m_time_map.to_beats(end_meas);
-    return {{end_beat, end_meas}, ActValidity::success};
+    return {{end_beat, end_meas}, ActValidity::success, sp_margin};
 }
 
 void ProcessedSong::append_activation(std::stringstream& stream,
@@ -392,17 +600,18 @@ void ProcessedSong::append_activation(std::stringstream& stream,
         while (previous_note->is_hold_point) {
             --previous_note;
         }
-        const auto colour = m_points.colour_set(previous_note);
+        const auto colour = m_points.colour_set_id(previous_note);
         auto same_colour_count = 1;
         for (auto p = std::next(previous_sp_note); p < previous_note; ++p) {
             if (p->is_hold_point) {
                 continue;
             }
-            if (m_points.colour_set(p) == colour) {
+            if (m_points.colour_set_id(p) == colour) {
                 ++same_colour_count;
             }
         }
-        stream << to_ordinal(same_colour_count) << ' ' << colour;
+        stream << to_ordinal(same_colour_count) << ' '
+               << m_points.colour_set(previous_note);
     } else if (count == 1) {
         stream << "NN";
     }
@@ -463,11 +672,10 @@ ProcessedSong::drum_act_summaries(const Path& path) const
             ++start_point;
         }
         const auto early_fill_point
-            = m_time_map.to_seconds(
-                  std::prev(start_point)->hit_window_start.beat)
+            = std::prev(start_point)->hit_window_start_seconds
             + SightRead::Second(2.0);
         const auto late_fill_point
-            = m_time_map.to_seconds(std::prev(start_point)->hit_window_end.beat)
+            = std::prev(start_point)->hit_window_end_seconds
             + SightRead::Second(2.0);
         const auto skipped_fills
             = std::count_if(start_point, act.act_start, [&](const auto& p) {
@@ -16,6 +16,7 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <cstddef>
 #include <cstdint>
 #include <stdexcept>
 
@@ -173,7 +174,32 @@ std::unique_ptr<QCommandLineParser> arg_parser()
          {"no-time-sigs", "Do not draw time signatures."},
          {"act-opacity",
           "Opacity of drawn activations (0.0 to 1.0). Default 0.33.",
-          "act-opacity", "0.33"}});
+          "act-opacity", "0.33"},
+         {"time-limit",
+          "Time limit for optimisation in milliseconds. If the optimal path "
+          "is not found in time, the best path found so far is used.",
+          "time-limit"},
+         {"checkpoint",
+          "File to save optimisation progress to. If the file is from an "
+          "earlier run on the same song and settings, optimisation resumes "
+          "from it.",
+          "file"},
+         {"checkpoint-interval",
+          "Seconds between saves to the checkpoint file. Default 60.",
+          "checkpoint-interval", "60"},
+         {"max-memory",
+          "Memory budget for the optimiser's memo in MiB. Results past the "
+          "budget are discarded and worked out again when needed, which "
+          "takes longer but gives the same path. Scores are always kept. "
+          "Must be at least 4 MiB.",
+          "max-memory"},
+         {"alternatives",
+          "Number of next best paths to summarise after the optimal path. "
+          "Default 0.",
+          "alternatives", "0"},
+         {"watch",
+          "Optimise again whenever the chart file is saved, reusing the "
+          "results the edits do not affect."}});
     return parser;
 }
 }
@@ -324,5 +350,50 @@ Settings from_args(const QStringList& args)
 
     settings.opacity = opacity;
 
+    if (parser->isSet("time-limit")) {
+        const auto time_limit = parser->value("time-limit").toInt();
+        if (time_limit <= 0) {
+            throw std::invalid_argument("Time limit must be greater than 0");
+        }
+        settings.time_limit = SightRead::Second {time_limit / MS_PER_SECOND};
+    }
+
+    settings.checkpoint_path = parser->value("checkpoint").toStdString();
+    const auto checkpoint_interval
+        = parser->value("checkpoint-interval").toInt();
+    if (checkpoint_interval <= 0) {
+        throw std::invalid_argument(
+            "Checkpoint interval must be greater than 0");
+    }
+    settings.checkpoint_interval = SightRead::Second {
+        static_cast<double>(checkpoint_interval)};
+
+    if (parser->isSet("max-memory")) {
+        constexpr std::size_t BYTES_PER_MIB = 1024 * 1024;
+        // The memo's scores, which are never freed, take about 30 bytes a
+        // note, so this leaves room for them on any real chart.
+        constexpr int MIN_MAX_MEMORY = 4;
+        const auto max_memory = parser->value("max-memory").toInt();
+        if (max_memory < MIN_MAX_MEMORY) {
+            throw std::invalid_argument("Memory budget must be at least "
+                                        + std::to_string(MIN_MAX_MEMORY)
+                                        + " MiB");
+        }
+        settings.max_memory
+            = static_cast<std::size_t>(max_memory) * BYTES_PER_MIB;
+    }
+
+    const auto alternatives = parser->value("alternatives").toInt();
+    if (alternatives < 0) {
+        throw std::invalid_argument("Alternatives must not be negative");
+    }
+    if (alternatives > 0 && settings.time_limit.has_value()) {
+        throw std::invalid_argument(
+            "Alternatives cannot be used with a time limit");
+    }
+    settings.alternatives = static_cast<std::size_t>(alternatives);
+
+    settings.watch = parser->isSet("watch");
+
     return settings;
 }
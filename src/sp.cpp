@@ -16,8 +16,12 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <iterator>
+#include <limits>
+#include <tuple>
 #include <utility>
 
 #include "sp.hpp"
@@ -73,6 +77,26 @@ note_spans(const SightRead::NoteTrack& track, double early_whammy,
     }
     return spans;
 }
+
+// Returns the indices [lo, hi) of the BeatRates strictly between start and
+// end.
+template <typename T>
+std::tuple<std::size_t, std::size_t>
+interior_indices(const std::vector<T>& beat_rates, SightRead::Beat start,
+                 SightRead::Beat end)
+{
+    const auto lo = std::upper_bound(
+        beat_rates.cbegin(), beat_rates.cend(), start,
+        [](const auto& x, const auto& y) { return x < y.position; });
+    const auto hi = std::lower_bound(
+        beat_rates.cbegin(), beat_rates.cend(), end,
+        [](const auto& x, const auto& y) { return x.position < y; });
+    const auto lo_index
+        = static_cast<std::size_t>(std::distance(beat_rates.cbegin(), lo));
+    const auto hi_index
+        = static_cast<std::size_t>(std::distance(beat_rates.cbegin(), hi));
+    return {lo_index, std::max(lo_index, hi_index)};
+}
 }
 
 std::vector<SpData::BeatRate>
@@ -122,19 +146,36 @@ SpData::SpData(const SightRead::NoteTrack& track, SpTimeMap time_map,
     , m_sp_gain_rate {engine.sp_gain_rate()}
     , m_default_net_sp_gain_rate {m_sp_gain_rate - 1 / DEFAULT_BEATS_PER_BAR}
 {
+    for (auto i = 1U; i < m_beat_rates.size(); ++i) {
+        const auto& prev = m_beat_rates[i - 1];
+        m_beat_rates[i].cumulative_sp_gain = prev.cumulative_sp_gain
+            + (m_beat_rates[i].position - prev.position).value()
+                * prev.net_sp_gain_rate;
+    }
+    if (!m_beat_rates.empty()) {
+        m_gain_tree.resize(4 * m_beat_rates.size());
+        build_gain_tree(1, 0, m_beat_rates.size());
+    }
+
     // Elements are (whammy start, whammy end, note).
     std::vector<std::tuple<SightRead::Beat, SightRead::Beat, SightRead::Beat>>
         ranges;
+    // note_spans is in position order, so the phrase containing each span
+    // can be found by only moving forward through the phrases.
+    auto phrase = track.sp_phrases().cbegin();
     for (const auto& [position, length, early_timing_window] :
          note_spans(track, squeeze_settings.early_whammy, engine)) {
         if (length == SightRead::Tick {0}) {
             continue;
         }
-        const auto pos_copy = position;
-        const auto phrase = std::find_if(
-            track.sp_phrases().cbegin(), track.sp_phrases().cend(),
-            [&](const auto& p) { return phrase_contains_pos(p, pos_copy); });
+        while (phrase != track.sp_phrases().cend()
+               && phrase->position + phrase->length <= position) {
+            ++phrase;
+        }
         if (phrase == track.sp_phrases().cend()) {
+            break;
+        }
+        if (!phrase_contains_pos(*phrase, position)) {
             continue;
         }
 
@@ -180,13 +221,121 @@ SpData::SpData(const SightRead::NoteTrack& track, SpTimeMap time_map,
     }
 
     m_last_whammy_point = m_whammy_ranges.back().end.beat;
-    auto p = m_whammy_ranges.cbegin();
-    for (auto pos = 0; pos < m_last_whammy_point.value(); ++pos) {
-        p = std::find_if_not(p, m_whammy_ranges.cend(), [=](const auto& x) {
-            return x.end.beat.value() <= pos;
-        });
-        m_initial_guesses.push_back(p);
+    m_whammy_bucket_width = std::max(
+        m_last_whammy_point.value()
+            / (WHAMMY_BUCKETS_PER_RANGE
+               * static_cast<double>(m_whammy_ranges.size())),
+        1.0);
+    const auto bucket_count = static_cast<std::size_t>(
+        std::ceil(m_last_whammy_point.value() / m_whammy_bucket_width));
+    m_whammy_range_buckets.reserve(bucket_count);
+    std::uint32_t index = 0;
+    for (auto i = 0U; i < bucket_count; ++i) {
+        const SightRead::Beat bucket_start {i * m_whammy_bucket_width};
+        while (index + 1 < m_whammy_ranges.size()
+               && m_whammy_ranges[index].end.beat <= bucket_start) {
+            ++index;
+        }
+        m_whammy_range_buckets.push_back(index);
+    }
+}
+
+SpData::SpGainSummary SpData::combine(const SpGainSummary& lhs,
+                                      const SpGainSummary& rhs)
+{
+    return {std::max(lhs.max, rhs.max), std::min(lhs.min, rhs.min),
+            std::max({lhs.max_drop, rhs.max_drop, lhs.max - rhs.min})};
+}
+
+void SpData::build_gain_tree(std::size_t node, std::size_t first,
+                             std::size_t last)
+{
+    if (last - first == 1) {
+        const auto gain = m_beat_rates[first].cumulative_sp_gain;
+        m_gain_tree[node] = {gain, gain, 0.0};
+        return;
+    }
+    const auto mid = first + (last - first) / 2;
+    build_gain_tree(2 * node, first, mid);
+    build_gain_tree(2 * node + 1, mid, last);
+    m_gain_tree[node] = combine(m_gain_tree[2 * node], m_gain_tree[2 * node + 1]);
+}
+
+SpData::SpGainSummary SpData::gain_summary(std::size_t node, std::size_t first,
+                                           std::size_t last, std::size_t lo,
+                                           std::size_t hi) const
+{
+    constexpr double POS_INF = std::numeric_limits<double>::infinity();
+
+    if (hi <= first || last <= lo) {
+        return {-POS_INF, POS_INF, 0.0};
+    }
+    if (lo <= first && last <= hi) {
+        return m_gain_tree[node];
+    }
+    const auto mid = first + (last - first) / 2;
+    return combine(gain_summary(2 * node, first, mid, lo, hi),
+                   gain_summary(2 * node + 1, mid, last, lo, hi));
+}
+
+// Returns the first index in [lo, hi) where SP has run out, or hi if there is
+// none. SP runs out at a point if the cumulative gain is below sp_floor, or if
+// it is more than a bar below the highest earlier gain (running_max). On
+// return running_max also covers every index before the one returned.
+std::size_t SpData::first_sp_exhaustion(std::size_t node, std::size_t first,
+                                        std::size_t last, std::size_t lo,
+                                        std::size_t hi, double sp_floor,
+                                        double& running_max) const
+{
+    if (hi <= first || last <= lo) {
+        return hi;
+    }
+    const auto& summary = m_gain_tree[node];
+    if (lo <= first && last <= hi) {
+        if (summary.min >= sp_floor && summary.max_drop <= 1.0
+            && running_max - summary.min <= 1.0) {
+            running_max = std::max(running_max, summary.max);
+            return hi;
+        }
+        if (last - first == 1) {
+            return first;
+        }
+    }
+    const auto mid = first + (last - first) / 2;
+    const auto left_result = first_sp_exhaustion(2 * node, first, mid, lo, hi,
+                                                 sp_floor, running_max);
+    if (left_result != hi) {
+        return left_result;
+    }
+    return first_sp_exhaustion(2 * node + 1, mid, last, lo, hi, sp_floor,
+                               running_max);
+}
+
+double SpData::cumulative_sp_gain(SightRead::Beat position) const
+{
+    auto p = std::upper_bound(
+        m_beat_rates.cbegin(), m_beat_rates.cend(), position,
+        [](const auto& x, const auto& y) { return x < y.position; });
+    if (p == m_beat_rates.cbegin()) {
+        const auto first_position = m_beat_rates.empty()
+            ? SightRead::Beat {0.0}
+            : m_beat_rates.front().position;
+        return (position - first_position).value() * m_default_net_sp_gain_rate;
+    }
+    --p;
+    return p->cumulative_sp_gain
+        + (position - p->position).value() * p->net_sp_gain_rate;
+}
+
+double SpData::net_sp_gain_rate_after(SightRead::Beat position) const
+{
+    auto p = std::upper_bound(
+        m_beat_rates.cbegin(), m_beat_rates.cend(), position,
+        [](const auto& x, const auto& y) { return x < y.position; });
+    if (p == m_beat_rates.cbegin()) {
+        return m_default_net_sp_gain_rate;
     }
+    return std::prev(p)->net_sp_gain_rate;
 }
 
 std::vector<SpData::WhammyRange>::const_iterator
@@ -195,34 +344,19 @@ SpData::first_whammy_range_after(SightRead::Beat pos) const
     if (m_last_whammy_point <= pos) {
         return m_whammy_ranges.cend();
     }
-    const auto index = static_cast<std::size_t>(pos.value());
-    const auto begin = (pos < SightRead::Beat(0.0)) ? m_whammy_ranges.cbegin()
-                                                    : m_initial_guesses[index];
+
+    auto begin = m_whammy_ranges.cbegin();
+    if (pos > SightRead::Beat(0.0)) {
+        const auto bucket = std::min(
+            static_cast<std::size_t>(pos.value() / m_whammy_bucket_width),
+            m_whammy_range_buckets.size() - 1);
+        begin = std::next(begin, m_whammy_range_buckets[bucket]);
+    }
 
     return std::find_if_not(begin, m_whammy_ranges.cend(),
                             [=](const auto& x) { return x.end.beat <= pos; });
 }
 
-SpData::WhammyPropagationState
-SpData::initial_whammy_prop_state(SightRead::Beat start, SightRead::Beat end,
-                                  double sp_bar_amount) const
-{
-    auto p = std::lower_bound(
-        m_beat_rates.cbegin(), m_beat_rates.cend(), start,
-        [](const auto& ts, const auto& y) { return ts.position < y; });
-    if (p != m_beat_rates.cbegin()) {
-        --p;
-    } else {
-        const auto subrange_end = std::min(end, p->position);
-        const auto sp_gain
-            = (subrange_end - start).value() * m_default_net_sp_gain_rate;
-        sp_bar_amount += sp_gain;
-        sp_bar_amount = std::min(sp_bar_amount, 1.0);
-        start = subrange_end;
-    }
-    return {p, start, sp_bar_amount};
-}
-
 double SpData::propagate_sp_over_whammy_max(SpPosition start, SpPosition end,
                                             double sp) const
 {
@@ -274,28 +408,74 @@ SpData::propagate_sp_over_whammy_min(SpPosition start, SpPosition end,
     return sp;
 }
 
+// The SP bar with whammy is the cumulative gain shifted to start at
+// sp_bar_amount, capped at a full bar. If G is that shifted gain then the bar
+// is G - max(0, M - 1), where M is the largest G so far, so both the final
+// value and the first point the bar empties follow from range queries on the
+// cumulative gain rather than stepping through every BeatRate.
+//
+// Before the first BeatRate the default rate applies, and the bar is capped
+// and can run out there like anywhere else. In particular, SP running out
+// before the first OD beat is caught even if the range also ends before it.
 double SpData::propagate_over_whammy_range(SightRead::Beat start,
                                            SightRead::Beat end,
                                            double sp_bar_amount) const
 {
-    auto state = initial_whammy_prop_state(start, end, sp_bar_amount);
-    while (state.current_position < end) {
-        auto subrange_end = end;
-        if (std::next(state.current_beat_rate) != m_beat_rates.cend()) {
-            subrange_end
-                = std::min(end, std::next(state.current_beat_rate)->position);
-        }
-        state.current_sp += (subrange_end - state.current_position).value()
-            * state.current_beat_rate->net_sp_gain_rate;
-        if (state.current_sp < 0.0) {
-            return -1.0;
+    const auto start_gain = cumulative_sp_gain(start);
+    const auto end_gain = cumulative_sp_gain(end);
+    const auto sp_floor = start_gain - sp_bar_amount;
+    const auto [lo, hi] = interior_indices(m_beat_rates, start, end);
+
+    auto summary = SpGainSummary {start_gain, start_gain, 0.0};
+    if (lo < hi) {
+        summary = combine(summary,
+                          gain_summary(1, 0, m_beat_rates.size(), lo, hi));
+    }
+    summary = combine(summary, {end_gain, end_gain, 0.0});
+    if (summary.min < sp_floor || summary.max_drop > 1.0) {
+        return -1.0;
+    }
+
+    const auto overflow = std::max(summary.max - sp_floor - 1.0, 0.0);
+    return end_gain - sp_floor - overflow;
+}
+
+// Return the point whammy runs out if all of the range [start, end) is
+// whammied.
+SightRead::Beat SpData::whammy_propagation_endpoint(SightRead::Beat start,
+                                                    SightRead::Beat end,
+                                                    double sp_bar_amount) const
+{
+    const auto start_gain = cumulative_sp_gain(start);
+    const auto sp_floor = start_gain - sp_bar_amount;
+    const auto [lo, hi] = interior_indices(m_beat_rates, start, end);
+
+    auto running_max = start_gain;
+    auto exhaustion = hi;
+    if (lo < hi) {
+        exhaustion = first_sp_exhaustion(1, 0, m_beat_rates.size(), lo, hi,
+                                         sp_floor, running_max);
+    }
+    if (exhaustion == hi) {
+        const auto end_gain = cumulative_sp_gain(end);
+        if (end_gain >= sp_floor && running_max - end_gain <= 1.0) {
+            return end;
         }
-        state.current_sp = std::min(state.current_sp, 1.0);
-        state.current_position = subrange_end;
-        ++state.current_beat_rate;
     }
 
-    return state.current_sp;
+    auto prev_position = start;
+    auto prev_gain = start_gain;
+    if (exhaustion > lo) {
+        prev_position = m_beat_rates[exhaustion - 1].position;
+        prev_gain = m_beat_rates[exhaustion - 1].cumulative_sp_gain;
+    }
+    const auto prev_sp
+        = prev_gain - sp_floor - std::max(running_max - sp_floor - 1.0, 0.0);
+    const auto rate = net_sp_gain_rate_after(prev_position);
+    if (rate >= 0.0) {
+        return prev_position;
+    }
+    return prev_position + SightRead::Beat(-prev_sp / rate);
 }
 
 bool SpData::is_in_whammy_ranges(SightRead::Beat beat) const
@@ -343,6 +523,90 @@ double SpData::available_whammy(SightRead::Beat start, SightRead::Beat end,
     return total_whammy;
 }
 
+// available_whammy is linear in the end beat within each whammy range, so the
+// range where sp_amount is reached can be found by walking the ranges and the
+// beat within it solved for directly.
+SightRead::Beat SpData::whammy_end_for_sp(SightRead::Beat start,
+                                          SightRead::Beat end,
+                                          SightRead::Beat note_pos,
+                                          double sp_amount) const
+{
+    for (auto p = first_whammy_range_after(start); p < m_whammy_ranges.cend();
+         ++p) {
+        if (p->start.beat >= end || p->note >= note_pos) {
+            break;
+        }
+        const auto whammy_start = std::max(p->start.beat, start);
+        const auto whammy_end = std::min(p->end.beat, end);
+        const auto range_sp
+            = (whammy_end - whammy_start).value() * m_sp_gain_rate;
+        if (range_sp >= sp_amount) {
+            return std::min(
+                whammy_start + SightRead::Beat(sp_amount / m_sp_gain_rate),
+                whammy_end);
+        }
+        sp_amount -= range_sp;
+    }
+
+    return end;
+}
+
+void SpData::add_to_fingerprint(Fingerprint& fingerprint) const
+{
+    fingerprint.add(m_sp_gain_rate);
+    fingerprint.add(m_default_net_sp_gain_rate);
+    for (const auto& rate : m_beat_rates) {
+        fingerprint.add(rate.position.value());
+        fingerprint.add(rate.net_sp_gain_rate);
+    }
+    for (const auto& range : m_whammy_ranges) {
+        fingerprint.add(range.start.beat.value());
+        fingerprint.add(range.start.sp_measure.value());
+        fingerprint.add(range.end.beat.value());
+        fingerprint.add(range.end.sp_measure.value());
+        fingerprint.add(range.note.value());
+    }
+}
+
+SightRead::Beat SpData::matches_from(const SpData& other) const
+{
+    const auto same_rate = [](const auto& lhs, const auto& rhs) {
+        return lhs.position.value() == rhs.position.value()
+            && lhs.net_sp_gain_rate == rhs.net_sp_gain_rate;
+    };
+    if (m_sp_gain_rate != other.m_sp_gain_rate
+        || m_default_net_sp_gain_rate != other.m_default_net_sp_gain_rate
+        || !std::equal(m_beat_rates.cbegin(), m_beat_rates.cend(),
+                       other.m_beat_rates.cbegin(), other.m_beat_rates.cend(),
+                       same_rate)) {
+        return SightRead::Beat {std::numeric_limits<double>::infinity()};
+    }
+
+    const auto same_range = [](const auto& lhs, const auto& rhs) {
+        return lhs.start.beat.value() == rhs.start.beat.value()
+            && lhs.end.beat.value() == rhs.end.beat.value()
+            && lhs.note.value() == rhs.note.value();
+    };
+    auto lhs = m_whammy_ranges.crbegin();
+    auto rhs = other.m_whammy_ranges.crbegin();
+    while (lhs != m_whammy_ranges.crend()
+           && rhs != other.m_whammy_ranges.crend() && same_range(*lhs, *rhs)) {
+        ++lhs;
+        ++rhs;
+    }
+
+    // The ranges that differ need not end in order, so every one of them is
+    // checked.
+    SightRead::Beat match_start {-std::numeric_limits<double>::infinity()};
+    for (; lhs != m_whammy_ranges.crend(); ++lhs) {
+        match_start = std::max(match_start, lhs->end.beat);
+    }
+    for (; rhs != other.m_whammy_ranges.crend(); ++rhs) {
+        match_start = std::max(match_start, rhs->end.beat);
+    }
+    return match_start;
+}
+
 SpPosition SpData::sp_drain_end_point(SpPosition start,
                                       double sp_bar_amount) const
 {
@@ -388,32 +652,3 @@ SpPosition SpData::activation_end_point(SpPosition start, SpPosition end,
     }
     return end;
 }
-
-// Return the point whammy runs out if all of the range [start, end) is
-// whammied.
-SightRead::Beat SpData::whammy_propagation_endpoint(SightRead::Beat start,
-                                                    SightRead::Beat end,
-                                                    double sp_bar_amount) const
-{
-    auto state = initial_whammy_prop_state(start, end, sp_bar_amount);
-    while (state.current_position < end) {
-        auto subrange_end = end;
-        if (std::next(state.current_beat_rate) != m_beat_rates.cend()) {
-            subrange_end
-                = std::min(end, std::next(state.current_beat_rate)->position);
-        }
-        auto sp_gain = (subrange_end - state.current_position).value()
-            * state.current_beat_rate->net_sp_gain_rate;
-        if (state.current_sp + sp_gain < 0.0) {
-            return state.current_position
-                + SightRead::Beat(-state.current_sp
-                                  / state.current_beat_rate->net_sp_gain_rate);
-        }
-        state.current_sp += sp_gain;
-        state.current_sp = std::min(state.current_sp, 1.0);
-        state.current_position = subrange_end;
-        ++state.current_beat_rate;
-    }
-
-    return end;
-}
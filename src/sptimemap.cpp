@@ -67,4 +67,21 @@ SpMeasure SpTimeMap::to_sp_measures(SightRead::Beat beats) const
 SpMeasure SpTimeMap::to_sp_measures(SightRead::Second seconds) const
 {
     return to_sp_measures(m_tempo_map.to_beats(seconds));
-}
\ No newline at end of file
+}
+
+void SpTimeMap::add_to_fingerprint(Fingerprint& fingerprint) const
+{
+    fingerprint.add(m_sp_mode);
+    for (const auto& bpm : m_tempo_map.bpms()) {
+        fingerprint.add(bpm.position.value());
+        fingerprint.add(bpm.bpm);
+    }
+    for (const auto& ts : m_tempo_map.time_sigs()) {
+        fingerprint.add(ts.position.value());
+        fingerprint.add(ts.numerator);
+        fingerprint.add(ts.denominator);
+    }
+    for (const auto& od_beat : m_tempo_map.od_beats()) {
+        fingerprint.add(od_beat.value());
+    }
+}
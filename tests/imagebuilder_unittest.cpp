@@ -1327,6 +1327,45 @@ BOOST_AUTO_TEST_CASE(set_total_score_sets_the_correct_value)
     BOOST_CHECK_EQUAL(builder.total_score(), 250);
 }
 
+BOOST_AUTO_TEST_CASE(bre_range_is_added_before_the_scores_and_bonus_after)
+{
+    SightRead::NoteTrack track {{make_note(0), make_note(768)},
+                                {},
+                                SightRead::TrackType::FiveFret,
+                                std::make_shared<SightRead::SongGlobalData>()};
+    PointSet points {track,
+                     {{}, SpMode::Measure},
+                     {},
+                     SqueezeSettings::default_settings(),
+                     SightRead::DrumSettings::default_settings(),
+                     ChGuitarEngine()};
+    ImageBuilder builder {track, SightRead::Difficulty::Expert,
+                          SightRead::DrumSettings::default_settings(), false,
+                          true};
+    const SightRead::TempoMap tempo_map {{}, {}, {}, 192};
+    const SightRead::BigRockEnding bre {SightRead::Tick {768},
+                                        SightRead::Tick {1536}};
+    Path path;
+
+    builder.add_bre(bre, tempo_map);
+    std::vector<std::tuple<double, double>> expected_bre_ranges {{4.0, 8.0}};
+
+    BOOST_CHECK_EQUAL_COLLECTIONS(
+        builder.bre_ranges().cbegin(), builder.bre_ranges().cend(),
+        expected_bre_ranges.cbegin(), expected_bre_ranges.cend());
+    BOOST_CHECK_EQUAL(builder.total_score(), 0);
+
+    builder.add_measure_values(points, tempo_map, path);
+    builder.set_total_score(points, {}, path);
+    builder.add_bre_bonus(bre, tempo_map);
+    std::vector<int> expected_score_values {50, 1850};
+
+    BOOST_CHECK_EQUAL_COLLECTIONS(
+        builder.score_values().cbegin(), builder.score_values().cend(),
+        expected_score_values.cbegin(), expected_score_values.cend());
+    BOOST_CHECK_EQUAL(builder.total_score(), 1850);
+}
+
 BOOST_AUTO_TEST_CASE(difficulty_is_handled)
 {
     SightRead::NoteTrack track {{make_note(0)},
@@ -18,7 +18,10 @@
 
 #include <algorithm>
 #include <cstdlib>
+#include <filesystem>
 #include <iterator>
+#include <limits>
+#include <utility>
 
 #include <boost/test/unit_test.hpp>
 
@@ -27,6 +30,99 @@
 
 namespace {
 const std::atomic<bool> term_bool {false};
+
+// Three notes with a phrase on each of the first two, so the only
+// activation is on the last note.
+SightRead::NoteTrack short_note_track()
+{
+    std::vector<SightRead::Note> notes {make_note(0), make_note(192),
+                                        make_note(384)};
+    std::vector<SightRead::StarPower> phrases {
+        {SightRead::Tick {0}, SightRead::Tick {50}},
+        {SightRead::Tick {192}, SightRead::Tick {50}}};
+    return {notes, phrases, SightRead::TrackType::FiveFret,
+            std::make_shared<SightRead::SongGlobalData>()};
+}
+
+// Alternating sustains and single notes with a phrase every twelve notes,
+// giving enough activations and ties that the search is not trivial.
+std::vector<SightRead::Note> long_track_notes()
+{
+    std::vector<SightRead::Note> notes;
+    for (auto i = 0; i < 64; ++i) {
+        const auto length = i % 2 == 0 ? 672 : 0;
+        notes.push_back(make_note(i * 192, length));
+    }
+    return notes;
+}
+
+std::vector<SightRead::StarPower> long_track_phrases()
+{
+    std::vector<SightRead::StarPower> phrases;
+    for (auto i = 0; i < 64; i += 12) {
+        phrases.push_back({SightRead::Tick {i * 192}, SightRead::Tick {673}});
+    }
+    return phrases;
+}
+
+SightRead::NoteTrack
+long_note_track(std::vector<SightRead::Note> notes = long_track_notes())
+{
+    return {std::move(notes), long_track_phrases(),
+            SightRead::TrackType::FiveFret,
+            std::make_shared<SightRead::SongGlobalData>()};
+}
+
+// Sustains of varying length among single notes of every colour, with
+// uneven gaps. The search on this chart reaches some points at more than one
+// position with the same best path, so memo entries have their intervals
+// extended.
+SightRead::NoteTrack varied_note_track()
+{
+    std::vector<SightRead::Note> notes;
+    std::vector<SightRead::StarPower> phrases;
+    auto tick = 0;
+    for (auto i = 0; i < 100; ++i) {
+        const auto length = i % 5 == 0 ? 96 + (i * 37) % 400 : 0;
+        notes.push_back(make_note(
+            tick, length, static_cast<SightRead::FiveFretNotes>(i % 5)));
+        if (i % 12 == 0) {
+            phrases.push_back(
+                {SightRead::Tick {tick},
+                 SightRead::Tick {std::max(length, 1) + 1}});
+        }
+        tick += 48 + 48 * ((i * 7) % 4) + length;
+    }
+    return {notes, phrases, SightRead::TrackType::FiveFret,
+            std::make_shared<SightRead::SongGlobalData>()};
+}
+
+// Evenly spaced notes with a phrase every sixteen, so the memo holds many
+// entries with activations.
+SightRead::NoteTrack sparse_phrase_note_track()
+{
+    std::vector<SightRead::Note> notes;
+    std::vector<SightRead::StarPower> phrases;
+    for (auto i = 0; i < 128; ++i) {
+        notes.push_back(make_note(i * 192));
+        if (i % 16 == 0) {
+            phrases.push_back({SightRead::Tick {i * 192}, SightRead::Tick {1}});
+        }
+    }
+    return {notes, phrases, SightRead::TrackType::FiveFret,
+            std::make_shared<SightRead::SongGlobalData>()};
+}
+
+ProcessedSong default_processed_song(const SightRead::NoteTrack& note_track)
+{
+    return {note_track,
+            {{}, SpMode::Measure},
+            SqueezeSettings::default_settings(),
+            SightRead::DrumSettings::default_settings(),
+            ChGuitarEngine(),
+            {},
+            {}};
+}
 }
 
 BOOST_AUTO_TEST_SUITE(overlap_guitar_paths)
@@ -537,6 +633,35 @@ BOOST_AUTO_TEST_CASE(easier_activations_are_chosen_where_possible)
     BOOST_CHECK_GT(opt_path.activations[0].sp_start.value(), 20.0);
 }
 
+// Every activation here covers nine notes, and so ties for the best score, but
+// needs some squeeze. The gaps shrink through the song, so the activations
+// from points 52 and 53 need the least squeeze. Far more activations tie than
+// a memo entry stores, so this checks the earliest of those is still picked
+// when the stored ties are bounded.
+BOOST_AUTO_TEST_CASE(least_squeezed_tie_is_chosen_when_no_tie_is_easy)
+{
+    std::vector<SightRead::Note> notes;
+    for (auto i = 0; i < 62; ++i) {
+        notes.push_back(make_note(390 * i - i * i / 24));
+    }
+    std::vector<SightRead::StarPower> phrases {
+        {SightRead::Tick {0}, SightRead::Tick {1}},
+        {SightRead::Tick {390}, SightRead::Tick {1}}};
+    SightRead::NoteTrack note_track {
+        notes, phrases, SightRead::TrackType::FiveFret,
+        std::make_shared<SightRead::SongGlobalData>()};
+    const auto track = default_processed_song(note_track);
+    Optimiser optimiser {&track, &term_bool, 100, SightRead::Second(0.0)};
+
+    const auto opt_path = optimiser.optimal_path();
+
+    BOOST_REQUIRE_EQUAL(opt_path.activations.size(), 1U);
+    const auto& act = opt_path.activations[0];
+    BOOST_CHECK_EQUAL(std::distance(track.points().cbegin(), act.act_start),
+                      52);
+    BOOST_CHECK_EQUAL(std::distance(track.points().cbegin(), act.act_end), 60);
+}
+
 // There was a bug where EW could be obtained from a note before the note was
 // hit. This came up in xOn Our Kneesx from CSC November 2020, where this makes
 // CHOpt believe you can activate before the GY note and get an extra 300
@@ -622,6 +747,74 @@ BOOST_AUTO_TEST_CASE(whammy_delay_is_handled_correctly)
     BOOST_CHECK_EQUAL(opt_path.score_boost, 550);
 }
 
+// Each block has two phrase notes followed by eight notes the activation
+// covers, and the blocks are far enough apart that the best path activates
+// once in each and starts the next block with an empty bar. The full path has
+// enough activations to be built across threads, while a query from one of
+// the last few blocks is built on this thread, so the two should agree on the
+// activations they share.
+BOOST_AUTO_TEST_CASE(activations_built_across_threads_match_ones_built_alone)
+{
+    constexpr auto BLOCK_COUNT = 40;
+    constexpr auto NOTES_PER_BLOCK = 10;
+    constexpr auto BLOCK_TICKS = 64 * 192;
+    constexpr auto QUERY_BLOCKS = 4;
+
+    std::vector<SightRead::Note> notes;
+    std::vector<SightRead::StarPower> phrases;
+    for (auto i = 0; i < BLOCK_COUNT; ++i) {
+        const auto block_start = i * BLOCK_TICKS;
+        for (auto j = 0; j < NOTES_PER_BLOCK; ++j) {
+            notes.push_back(make_note(block_start + j * 192));
+        }
+        phrases.push_back({SightRead::Tick {block_start}, SightRead::Tick {1}});
+        phrases.push_back(
+            {SightRead::Tick {block_start + 192}, SightRead::Tick {1}});
+    }
+    SightRead::NoteTrack note_track {
+        notes, phrases, SightRead::TrackType::FiveFret,
+        std::make_shared<SightRead::SongGlobalData>()};
+    const auto track = default_processed_song(note_track);
+    Optimiser optimiser {&track, &term_bool, 100, SightRead::Second(0.0)};
+    const auto& points = track.points();
+    const auto opt_path = optimiser.optimal_path();
+    constexpr auto QUERY_INDEX = (BLOCK_COUNT - QUERY_BLOCKS) * NOTES_PER_BLOCK;
+    const auto position
+        = std::prev(points.cbegin() + QUERY_INDEX)->hit_window_end;
+    const auto path = optimiser.best_path_from(QUERY_INDEX, 0.0, position);
+
+    BOOST_REQUIRE_EQUAL(opt_path.activations.size(), BLOCK_COUNT);
+    BOOST_CHECK_EQUAL_COLLECTIONS(
+        path.activations.cbegin(), path.activations.cend(),
+        opt_path.activations.cend() - QUERY_BLOCKS,
+        opt_path.activations.cend());
+}
+
+// A phrase on each of 50000 notes four bars apart gives an optimal path of
+// 9999 activations. A recursive search nests a call per activation, which
+// overflowed the default stack on this chart.
+BOOST_AUTO_TEST_CASE(songs_with_very_long_paths_are_handled)
+{
+    constexpr auto NOTE_COUNT = 50000;
+
+    std::vector<SightRead::Note> notes;
+    std::vector<SightRead::StarPower> phrases;
+    for (auto i = 0; i < NOTE_COUNT; ++i) {
+        notes.push_back(make_note(i * 3072));
+        phrases.push_back({SightRead::Tick {i * 3072}, SightRead::Tick {2}});
+    }
+    SightRead::NoteTrack note_track {
+        notes, phrases, SightRead::TrackType::FiveFret,
+        std::make_shared<SightRead::SongGlobalData>()};
+    const auto track = default_processed_song(note_track);
+    Optimiser optimiser {&track, &term_bool, 100, SightRead::Second(0.0)};
+
+    const auto opt_path = optimiser.optimal_path();
+
+    BOOST_CHECK_EQUAL(opt_path.activations.size(), 9999U);
+    BOOST_CHECK_EQUAL(opt_path.score_boost, 5998350);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 BOOST_AUTO_TEST_SUITE(drum_paths)
@@ -950,3 +1143,560 @@ BOOST_AUTO_TEST_CASE(quarter_bar_activations_are_possible_on_fortnite_engine)
                                   opt_path.activations.cend(),
                                   optimal_acts.cbegin(), optimal_acts.cend());
 }
+
+BOOST_AUTO_TEST_SUITE(best_path_within_works_correctly)
+
+BOOST_AUTO_TEST_CASE(optimal_path_is_returned_given_enough_time)
+{
+    const auto note_track = short_note_track();
+    const auto track = default_processed_song(note_track);
+    Optimiser optimiser {&track, &term_bool, 100, SightRead::Second(0.0)};
+    const auto& points = track.points();
+    std::vector<Activation> optimal_acts {
+        {points.cbegin() + 2, points.cbegin() + 2, SightRead::Beat {0.0},
+         SightRead::Beat {2.0}, SightRead::Beat {18.0}}};
+    const auto result = optimiser.best_path_within(SightRead::Second(60.0));
+
+    BOOST_TEST(result.is_optimal);
+    BOOST_CHECK_EQUAL(result.path.score_boost, 50);
+    BOOST_CHECK_EQUAL_COLLECTIONS(result.path.activations.cbegin(),
+                                  result.path.activations.cend(),
+                                  optimal_acts.cbegin(), optimal_acts.cend());
+}
+
+BOOST_AUTO_TEST_CASE(out_of_time_path_is_a_valid_path_no_better_than_optimal)
+{
+    const auto note_track = long_note_track();
+    const auto track = default_processed_song(note_track);
+    Optimiser optimiser {&track, &term_bool, 100, SightRead::Second(0.0)};
+    const auto opt_path = optimiser.optimal_path();
+
+    Optimiser timed_optimiser {&track, &term_bool, 100,
+                               SightRead::Second(0.0)};
+    const auto result
+        = timed_optimiser.best_path_within(SightRead::Second(0.0));
+    const auto& acts = result.path.activations;
+
+    BOOST_TEST(!result.is_optimal);
+    BOOST_TEST(!acts.empty());
+    BOOST_CHECK_LE(result.path.score_boost, opt_path.score_boost);
+    for (auto i = 0U; i < acts.size(); ++i) {
+        BOOST_CHECK(acts[i].act_start <= acts[i].act_end);
+        if (i > 0) {
+            BOOST_CHECK(acts[i - 1].act_end < acts[i].act_start);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(best_paths_works_correctly)
+
+BOOST_AUTO_TEST_CASE(first_path_is_optimal_and_rest_are_distinct_and_worse)
+{
+    const auto note_track = long_note_track();
+    const auto track = default_processed_song(note_track);
+    Optimiser optimiser {&track, &term_bool, 100, SightRead::Second(0.0)};
+    const auto opt_path = optimiser.optimal_path();
+    const auto paths = optimiser.best_paths(3);
+
+    BOOST_REQUIRE_EQUAL(paths.size(), 3U);
+    BOOST_CHECK_EQUAL(paths[0].score_boost, opt_path.score_boost);
+    BOOST_CHECK_EQUAL_COLLECTIONS(
+        paths[0].activations.cbegin(), paths[0].activations.cend(),
+        opt_path.activations.cbegin(), opt_path.activations.cend());
+    for (auto i = 1U; i < paths.size(); ++i) {
+        BOOST_CHECK_LE(paths[i].score_boost, paths[i - 1].score_boost);
+        for (auto j = 0U; j < i; ++j) {
+            const auto& lhs = paths[i].activations;
+            const auto& rhs = paths[j].activations;
+            const auto is_same = std::equal(
+                lhs.cbegin(), lhs.cend(), rhs.cbegin(), rhs.cend(),
+                [](const auto& x, const auto& y) {
+                    return x.act_start == y.act_start
+                        && x.act_end == y.act_end;
+                });
+            BOOST_TEST(!is_same);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(activations_after_waiting_past_several_phrases_are_offered)
+{
+    std::vector<SightRead::Note> notes;
+    for (auto beat : {0, 1, 2, 3, 4, 5, 40, 41, 42, 43}) {
+        notes.push_back(make_note(beat * 192));
+    }
+    std::vector<SightRead::StarPower> phrases;
+    for (auto beat : {0, 1, 2, 3, 40}) {
+        phrases.push_back({SightRead::Tick {beat * 192}, SightRead::Tick {1}});
+    }
+    SightRead::NoteTrack note_track {
+        notes, phrases, SightRead::TrackType::FiveFret,
+        std::make_shared<SightRead::SongGlobalData>()};
+    const auto track = default_processed_song(note_track);
+    Optimiser optimiser {&track, &term_bool, 100, SightRead::Second(0.0)};
+    const auto& points = track.points();
+    const auto paths = optimiser.best_paths(10);
+    const auto is_offered = [&](std::ptrdiff_t start_index) {
+        return std::any_of(
+            paths.cbegin(), paths.cend(), [&](const auto& path) {
+                return !path.activations.empty()
+                    && path.activations[0].act_start
+                    == std::next(points.cbegin(), start_index);
+            });
+    };
+
+    BOOST_TEST(is_offered(2));
+    BOOST_TEST(is_offered(4));
+    BOOST_TEST(is_offered(7));
+}
+
+BOOST_AUTO_TEST_CASE(paths_with_equal_scores_are_all_returned)
+{
+    std::vector<SightRead::Note> notes {make_note(0), make_note(192),
+                                        make_note(384), make_note(11520)};
+    std::vector<SightRead::StarPower> phrases {
+        {SightRead::Tick {0}, SightRead::Tick {50}},
+        {SightRead::Tick {192}, SightRead::Tick {50}}};
+    SightRead::NoteTrack note_track {
+        notes, phrases, SightRead::TrackType::FiveFret,
+        std::make_shared<SightRead::SongGlobalData>()};
+    const auto track = default_processed_song(note_track);
+    Optimiser optimiser {&track, &term_bool, 100, SightRead::Second(0.0)};
+    const auto& points = track.points();
+    const auto opt_path = optimiser.optimal_path();
+    const auto paths = optimiser.best_paths(3);
+
+    BOOST_REQUIRE_EQUAL(paths.size(), 2U);
+    BOOST_CHECK_EQUAL_COLLECTIONS(
+        paths[0].activations.cbegin(), paths[0].activations.cend(),
+        opt_path.activations.cbegin(), opt_path.activations.cend());
+    for (const auto& path : paths) {
+        BOOST_CHECK_EQUAL(path.score_boost, 50);
+        BOOST_REQUIRE_EQUAL(path.activations.size(), 1U);
+    }
+    BOOST_CHECK(paths[0].activations[0].act_start == points.cbegin() + 2);
+    BOOST_CHECK(paths[1].activations[0].act_start == points.cbegin() + 3);
+}
+
+BOOST_AUTO_TEST_CASE(fewer_paths_are_returned_if_fewer_exist)
+{
+    const auto note_track = short_note_track();
+    const auto track = default_processed_song(note_track);
+    Optimiser optimiser {&track, &term_bool, 100, SightRead::Second(0.0)};
+    const auto paths = optimiser.best_paths(3);
+
+    BOOST_REQUIRE_EQUAL(paths.size(), 1U);
+    BOOST_CHECK_EQUAL(paths[0].score_boost, 50);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(best_path_from_works_correctly)
+
+BOOST_AUTO_TEST_CASE(mid_song_queries_only_activate_from_the_given_point)
+{
+    constexpr std::size_t POINT_INDEX = 30;
+
+    const auto note_track = long_note_track();
+    const auto track = default_processed_song(note_track);
+    Optimiser optimiser {&track, &term_bool, 100, SightRead::Second(0.0)};
+    const auto& points = track.points();
+    const auto first_point = points.cbegin() + POINT_INDEX;
+    const auto position = std::prev(first_point)->hit_window_end;
+
+    const auto empty_path
+        = optimiser.best_path_from(POINT_INDEX, 0.0, position);
+    const auto full_path
+        = optimiser.best_path_from(POINT_INDEX, 1.0, position);
+
+    BOOST_CHECK_LE(empty_path.score_boost, full_path.score_boost);
+    BOOST_REQUIRE(!full_path.activations.empty());
+    BOOST_CHECK(full_path.activations[0].act_start == first_point);
+    for (const auto& act : empty_path.activations) {
+        BOOST_CHECK(act.act_start >= first_point);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sp_in_the_bar_is_taken_into_account)
+{
+    const auto note_track = short_note_track();
+    const auto track = default_processed_song(note_track);
+    Optimiser optimiser {&track, &term_bool, 100, SightRead::Second(0.0)};
+    const auto& points = track.points();
+    const auto position = points.cbegin()->hit_window_start;
+
+    BOOST_CHECK_EQUAL(optimiser.best_path_from(1, 0.0, position).score_boost,
+                      0);
+    BOOST_CHECK_EQUAL(optimiser.best_path_from(1, 0.25, position).score_boost,
+                      50);
+    const auto path = optimiser.best_path_from(1, 0.5, position);
+    BOOST_CHECK_EQUAL(path.score_boost, 100);
+    BOOST_REQUIRE_EQUAL(path.activations.size(), 1U);
+    BOOST_CHECK(path.activations[0].act_start == points.cbegin() + 1);
+    BOOST_CHECK(path.activations[0].act_end == points.cbegin() + 2);
+}
+
+BOOST_AUTO_TEST_CASE(queries_from_the_middle_of_a_phrase_still_get_its_sp)
+{
+    std::vector<SightRead::Note> notes;
+    for (auto i = 0; i < 8; ++i) {
+        notes.push_back(make_note(i * 192));
+    }
+    std::vector<SightRead::StarPower> phrases {
+        {SightRead::Tick {0}, SightRead::Tick {4 * 192}},
+        {SightRead::Tick {4 * 192}, SightRead::Tick {2 * 192}}};
+    SightRead::NoteTrack note_track {
+        notes, phrases, SightRead::TrackType::FiveFret,
+        std::make_shared<SightRead::SongGlobalData>()};
+    const auto track = default_processed_song(note_track);
+    Optimiser optimiser {&track, &term_bool, 100, SightRead::Second(0.0)};
+    const auto& points = track.points();
+    const auto position = std::next(points.cbegin())->hit_window_end;
+
+    const auto empty_path = optimiser.best_path_from(2, 0.0, position);
+    const auto path = optimiser.best_path_from(2, 0.25, position);
+
+    BOOST_REQUIRE(!empty_path.activations.empty());
+    BOOST_REQUIRE(!path.activations.empty());
+    BOOST_CHECK(empty_path.activations[0].act_start == points.cbegin() + 6);
+    BOOST_CHECK(path.activations[0].act_start == points.cbegin() + 4);
+    BOOST_CHECK_GT(path.score_boost, empty_path.score_boost);
+}
+
+BOOST_AUTO_TEST_CASE(queries_after_a_search_do_not_search_again)
+{
+    const auto note_track = long_note_track();
+    const auto track = default_processed_song(note_track);
+    Optimiser optimiser {&track, &term_bool, 100, SightRead::Second(0.0)};
+    const auto& points = track.points();
+    const auto optimal_path = optimiser.optimal_path();
+    const auto searched_keys = optimiser.cache_stats().searched_keys;
+
+    const auto path = optimiser.best_path_from(
+        0, 0.0, points.cbegin()->hit_window_start);
+
+    BOOST_CHECK_GT(searched_keys, 0U);
+    BOOST_CHECK_EQUAL(optimiser.cache_stats().searched_keys, searched_keys);
+    BOOST_CHECK_EQUAL(path.score_boost, optimal_path.score_boost);
+}
+
+BOOST_AUTO_TEST_CASE(repeated_queries_do_not_search_again)
+{
+    constexpr std::size_t POINT_INDEX = 30;
+
+    const auto note_track = long_note_track();
+    const auto track = default_processed_song(note_track);
+    Optimiser optimiser {&track, &term_bool, 100, SightRead::Second(0.0)};
+    const auto& points = track.points();
+    const auto position
+        = std::prev(points.cbegin() + POINT_INDEX)->hit_window_end;
+    const auto first_path
+        = optimiser.best_path_from(POINT_INDEX, 0.5, position);
+    const auto searched_keys = optimiser.cache_stats().searched_keys;
+
+    const auto path = optimiser.best_path_from(POINT_INDEX, 0.5, position);
+
+    BOOST_CHECK_EQUAL(optimiser.cache_stats().searched_keys, searched_keys);
+    BOOST_CHECK_EQUAL(path.score_boost, first_path.score_boost);
+}
+
+BOOST_AUTO_TEST_CASE(invalid_queries_throw)
+{
+    std::vector<SightRead::Note> notes {make_note(0), make_note(192)};
+    SightRead::NoteTrack note_track {
+        notes, {}, SightRead::TrackType::FiveFret,
+        std::make_shared<SightRead::SongGlobalData>()};
+    const auto track = default_processed_song(note_track);
+    Optimiser optimiser {&track, &term_bool, 100, SightRead::Second(0.0)};
+    const SpPosition position {SightRead::Beat(0.0), SpMeasure(0.0)};
+
+    BOOST_CHECK_THROW(
+        [&] { return optimiser.best_path_from(3, 0.0, position); }(),
+        std::invalid_argument);
+    BOOST_CHECK_THROW(
+        [&] { return optimiser.best_path_from(0, 1.5, position); }(),
+        std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(reuse_memo_works_correctly)
+
+BOOST_AUTO_TEST_CASE(reused_memo_gives_the_same_score_after_an_edit)
+{
+    auto edited_notes = long_track_notes();
+    edited_notes[2] = make_note(384);
+    const auto note_track = long_note_track();
+    const auto edited_note_track = long_note_track(edited_notes);
+    const auto track = default_processed_song(note_track);
+    const auto edited_track = default_processed_song(edited_note_track);
+    Optimiser optimiser {&track, &term_bool, 100, SightRead::Second(0.0)};
+    static_cast<void>(optimiser.optimal_path());
+    Optimiser fresh_optimiser {&edited_track, &term_bool, 100,
+                               SightRead::Second(0.0)};
+    const auto fresh_path = fresh_optimiser.optimal_path();
+
+    Optimiser edited_optimiser {&edited_track, &term_bool, 100,
+                                SightRead::Second(0.0)};
+    const auto reused_entries = edited_optimiser.reuse_memo(optimiser);
+    const auto path = edited_optimiser.optimal_path();
+
+    BOOST_CHECK_GT(reused_entries, 0U);
+    BOOST_CHECK_EQUAL(path.score_boost, fresh_path.score_boost);
+}
+
+BOOST_AUTO_TEST_CASE(nothing_is_reused_before_a_search)
+{
+    const auto note_track = short_note_track();
+    const auto track = default_processed_song(note_track);
+    Optimiser optimiser {&track, &term_bool, 100, SightRead::Second(0.0)};
+    Optimiser next_optimiser {&track, &term_bool, 100, SightRead::Second(0.0)};
+
+    BOOST_CHECK_EQUAL(next_optimiser.reuse_memo(optimiser), 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(checkpoints_work_correctly)
+
+BOOST_AUTO_TEST_CASE(resumed_optimisation_gives_the_same_path)
+{
+    std::vector<SightRead::Note> notes {make_note(0), make_note(192),
+                                        make_note(384), make_note(3840)};
+    std::vector<SightRead::StarPower> phrases {
+        {SightRead::Tick {0}, SightRead::Tick {50}},
+        {SightRead::Tick {192}, SightRead::Tick {50}}};
+    SightRead::NoteTrack note_track {
+        notes, phrases, SightRead::TrackType::FiveFret,
+        std::make_shared<SightRead::SongGlobalData>()};
+    const auto track = default_processed_song(note_track);
+    const auto path = std::filesystem::temp_directory_path()
+        / "chopt_resumed_optimisation.chkpt";
+    std::filesystem::remove(path);
+
+    Optimiser optimiser {&track, &term_bool, 100, SightRead::Second(0.0)};
+    optimiser.set_checkpoint(path.string(), SightRead::Second(0.0));
+    const auto first_path = optimiser.optimal_path();
+    const auto checkpoint_size = std::filesystem::file_size(path);
+
+    Optimiser resumed_optimiser {&track, &term_bool, 100,
+                                 SightRead::Second(0.0)};
+    resumed_optimiser.set_checkpoint(path.string(), SightRead::Second(0.0));
+    const auto resumed_path = resumed_optimiser.optimal_path();
+
+    BOOST_CHECK_EQUAL(resumed_path.score_boost, first_path.score_boost);
+    BOOST_CHECK_EQUAL_COLLECTIONS(
+        resumed_path.activations.cbegin(), resumed_path.activations.cend(),
+        first_path.activations.cbegin(), first_path.activations.cend());
+    BOOST_CHECK_EQUAL(std::filesystem::file_size(path), checkpoint_size);
+
+    std::filesystem::remove(path);
+}
+
+// Keys covered by an earlier entry's interval are not stored themselves, so
+// the intervals have to be saved for a resumed search to need no searching.
+BOOST_AUTO_TEST_CASE(resumed_optimisation_searches_no_keys)
+{
+    const auto note_track = varied_note_track();
+    const auto track = default_processed_song(note_track);
+    const auto path = std::filesystem::temp_directory_path()
+        / "chopt_resumed_intervals.chkpt";
+    std::filesystem::remove(path);
+
+    Optimiser optimiser {&track, &term_bool, 100, SightRead::Second(0.0)};
+    optimiser.set_checkpoint(path.string(), SightRead::Second(0.0));
+    const auto first_path = optimiser.optimal_path();
+    const auto checkpoint_size = std::filesystem::file_size(path);
+
+    Optimiser resumed_optimiser {&track, &term_bool, 100,
+                                 SightRead::Second(0.0)};
+    resumed_optimiser.set_checkpoint(path.string(), SightRead::Second(0.0));
+    const auto resumed_path = resumed_optimiser.optimal_path();
+
+    BOOST_CHECK_EQUAL(resumed_optimiser.cache_stats().searched_keys, 0U);
+    BOOST_CHECK_EQUAL(std::filesystem::file_size(path), checkpoint_size);
+    BOOST_CHECK_EQUAL(resumed_path.score_boost, first_path.score_boost);
+
+    std::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(queries_after_a_search_do_not_add_to_the_checkpoint)
+{
+    constexpr std::size_t POINT_INDEX = 30;
+
+    const auto note_track = long_note_track();
+    const auto track = default_processed_song(note_track);
+    const auto path = std::filesystem::temp_directory_path()
+        / "chopt_queries_after_search.chkpt";
+    std::filesystem::remove(path);
+
+    Optimiser optimiser {&track, &term_bool, 100, SightRead::Second(0.0)};
+    optimiser.set_checkpoint(path.string(), SightRead::Second(0.0));
+    static_cast<void>(optimiser.optimal_path());
+    const auto checkpoint_size = std::filesystem::file_size(path);
+    const auto searched_keys = optimiser.cache_stats().searched_keys;
+    const auto position
+        = std::prev(track.points().cbegin() + POINT_INDEX)->hit_window_end;
+    static_cast<void>(optimiser.best_path_from(POINT_INDEX, 0.5, position));
+    static_cast<void>(optimiser.best_paths(3));
+
+    BOOST_CHECK_GT(optimiser.cache_stats().searched_keys, searched_keys);
+    BOOST_CHECK_EQUAL(std::filesystem::file_size(path), checkpoint_size);
+
+    std::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(checkpoints_for_other_songs_are_ignored)
+{
+    const auto note_track = short_note_track();
+    const auto track = default_processed_song(note_track);
+    auto other_notes = note_track.notes();
+    other_notes.push_back(make_note(576));
+    SightRead::NoteTrack other_note_track {
+        other_notes, note_track.sp_phrases(), SightRead::TrackType::FiveFret,
+        std::make_shared<SightRead::SongGlobalData>()};
+    const auto other_track = default_processed_song(other_note_track);
+    const auto path = std::filesystem::temp_directory_path()
+        / "chopt_other_song.chkpt";
+    std::filesystem::remove(path);
+
+    Optimiser other_optimiser {&other_track, &term_bool, 100,
+                               SightRead::Second(0.0)};
+    other_optimiser.set_checkpoint(path.string(), SightRead::Second(0.0));
+    static_cast<void>(other_optimiser.optimal_path());
+
+    Optimiser optimiser {&track, &term_bool, 100, SightRead::Second(0.0)};
+    optimiser.set_checkpoint(path.string(), SightRead::Second(0.0));
+    const auto& points = track.points();
+    std::vector<Activation> optimal_acts {
+        {points.cbegin() + 2, points.cbegin() + 2, SightRead::Beat {0.0},
+         SightRead::Beat {2.0}, SightRead::Beat {18.0}}};
+    const auto opt_path = optimiser.optimal_path();
+
+    BOOST_CHECK_GT(optimiser.cache_stats().searched_keys, 0U);
+    BOOST_CHECK_EQUAL(opt_path.score_boost, 50);
+    BOOST_CHECK_EQUAL_COLLECTIONS(opt_path.activations.cbegin(),
+                                  opt_path.activations.cend(),
+                                  optimal_acts.cbegin(), optimal_acts.cend());
+
+    std::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(checkpoints_for_songs_with_a_moved_note_are_ignored)
+{
+    const auto note_track = long_note_track();
+    const auto track = default_processed_song(note_track);
+    auto other_notes = long_track_notes();
+    other_notes.back().position = SightRead::Tick {64 * 192};
+    const auto other_note_track = long_note_track(other_notes);
+    const auto other_track = default_processed_song(other_note_track);
+    const auto path = std::filesystem::temp_directory_path()
+        / "chopt_moved_note.chkpt";
+    std::filesystem::remove(path);
+
+    Optimiser other_optimiser {&other_track, &term_bool, 100,
+                               SightRead::Second(0.0)};
+    other_optimiser.set_checkpoint(path.string(), SightRead::Second(0.0));
+    static_cast<void>(other_optimiser.optimal_path());
+
+    Optimiser optimiser {&track, &term_bool, 100, SightRead::Second(0.0)};
+    optimiser.set_checkpoint(path.string(), SightRead::Second(0.0));
+    const auto opt_path = optimiser.optimal_path();
+    Optimiser fresh_optimiser {&track, &term_bool, 100,
+                               SightRead::Second(0.0)};
+    const auto fresh_path = fresh_optimiser.optimal_path();
+
+    BOOST_CHECK_EQUAL(optimiser.cache_stats().searched_keys,
+                      fresh_optimiser.cache_stats().searched_keys);
+    BOOST_CHECK_EQUAL(opt_path.score_boost, fresh_path.score_boost);
+    BOOST_CHECK_EQUAL_COLLECTIONS(
+        opt_path.activations.cbegin(), opt_path.activations.cend(),
+        fresh_path.activations.cbegin(), fresh_path.activations.cend());
+
+    std::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(max_memory_works_correctly)
+
+BOOST_AUTO_TEST_CASE(evicted_entries_give_the_same_path_within_the_budget)
+{
+    const auto note_track = sparse_phrase_note_track();
+    const auto track = default_processed_song(note_track);
+    Optimiser optimiser {&track, &term_bool, 100, SightRead::Second(0.0)};
+    optimiser.set_max_memory(std::numeric_limits<std::size_t>::max());
+    const auto opt_path = optimiser.optimal_path();
+    const auto full_stats = optimiser.cache_stats();
+    const auto budget = full_stats.kept_memo_bytes
+        + (full_stats.peak_memo_bytes - full_stats.kept_memo_bytes) / 8;
+
+    Optimiser capped_optimiser {&track, &term_bool, 100,
+                                SightRead::Second(0.0)};
+    capped_optimiser.set_max_memory(budget);
+    const auto capped_path = capped_optimiser.optimal_path();
+    const auto stats = capped_optimiser.cache_stats();
+
+    BOOST_CHECK_EQUAL(full_stats.evictions, 0U);
+    BOOST_CHECK_GT(stats.evictions, 0U);
+    BOOST_CHECK_GT(stats.recomputations, 0U);
+    BOOST_CHECK_LE(stats.peak_memo_bytes, budget);
+    BOOST_CHECK_EQUAL(capped_path.score_boost, opt_path.score_boost);
+    BOOST_CHECK_EQUAL_COLLECTIONS(
+        capped_path.activations.cbegin(), capped_path.activations.cend(),
+        opt_path.activations.cbegin(), opt_path.activations.cend());
+}
+
+BOOST_AUTO_TEST_CASE(tighter_budgets_evict_and_recompute_more)
+{
+    const auto note_track = sparse_phrase_note_track();
+    const auto track = default_processed_song(note_track);
+    Optimiser optimiser {&track, &term_bool, 100, SightRead::Second(0.0)};
+    static_cast<void>(optimiser.optimal_path());
+    const auto full_stats = optimiser.cache_stats();
+    const auto spare_bytes
+        = full_stats.peak_memo_bytes - full_stats.kept_memo_bytes;
+
+    std::vector<Optimiser::CacheStats> stats;
+    for (auto divisor : {1U, 2U, 8U}) {
+        Optimiser capped_optimiser {&track, &term_bool, 100,
+                                    SightRead::Second(0.0)};
+        capped_optimiser.set_max_memory(full_stats.kept_memo_bytes
+                                        + spare_bytes / divisor);
+        static_cast<void>(capped_optimiser.optimal_path());
+        stats.push_back(capped_optimiser.cache_stats());
+    }
+
+    BOOST_CHECK_EQUAL(stats[0].evictions, 0U);
+    BOOST_CHECK_EQUAL(stats[0].recomputations, 0U);
+    for (auto i = 1U; i < stats.size(); ++i) {
+        BOOST_CHECK_GT(stats[i].evictions, stats[i - 1].evictions);
+        BOOST_CHECK_GE(stats[i].recomputations, stats[i - 1].recomputations);
+    }
+    BOOST_CHECK_GT(stats.back().recomputations, 0U);
+}
+
+BOOST_AUTO_TEST_CASE(budgets_too_small_for_the_scores_keep_only_the_scores)
+{
+    const auto note_track = long_note_track();
+    const auto track = default_processed_song(note_track);
+    Optimiser optimiser {&track, &term_bool, 100, SightRead::Second(0.0)};
+    const auto opt_path = optimiser.optimal_path();
+
+    Optimiser capped_optimiser {&track, &term_bool, 100,
+                                SightRead::Second(0.0)};
+    capped_optimiser.set_max_memory(1);
+    const auto capped_path = capped_optimiser.optimal_path();
+    const auto stats = capped_optimiser.cache_stats();
+
+    BOOST_CHECK_GT(stats.evictions, 0U);
+    BOOST_CHECK_EQUAL(stats.peak_memo_bytes, stats.kept_memo_bytes);
+    BOOST_CHECK_EQUAL(capped_path.score_boost, opt_path.score_boost);
+    BOOST_CHECK_EQUAL_COLLECTIONS(
+        capped_path.activations.cbegin(), capped_path.activations.cend(),
+        opt_path.activations.cbegin(), opt_path.activations.cend());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -909,6 +909,32 @@ BOOST_AUTO_TEST_CASE(next_sp_granting_note_is_correct)
         std::prev(points.cend()));
 }
 
+BOOST_AUTO_TEST_CASE(next_fill_point_is_correct)
+{
+    std::vector<SightRead::Note> notes {make_drum_note(0), make_drum_note(192),
+                                        make_drum_note(384)};
+    std::vector<SightRead::DrumFill> fills {
+        {SightRead::Tick {300}, SightRead::Tick {84}}};
+    SightRead::NoteTrack track {notes,
+                                {},
+                                SightRead::TrackType::Drums,
+                                std::make_unique<SightRead::SongGlobalData>()};
+    track.drum_fills(fills);
+
+    PointSet points {track,
+                     {{}, SpMode::Measure},
+                     {},
+                     SqueezeSettings::default_settings(),
+                     SightRead::DrumSettings::default_settings(),
+                     ChDrumEngine()};
+
+    BOOST_CHECK_EQUAL(points.next_fill_point(points.cbegin()),
+                      std::prev(points.cend()));
+    BOOST_CHECK_EQUAL(points.next_fill_point(std::prev(points.cend())),
+                      std::prev(points.cend()));
+    BOOST_CHECK_EQUAL(points.next_fill_point(points.cend()), points.cend());
+}
+
 BOOST_AUTO_TEST_CASE(solo_sections_are_added)
 {
     std::vector<SightRead::Solo> solos {
@@ -980,6 +1006,30 @@ BOOST_AUTO_TEST_CASE(colour_set_is_correct_for_five_fret)
     BOOST_CHECK_EQUAL(points.colour_set(end - 1), "B");
 }
 
+BOOST_AUTO_TEST_CASE(colour_set_ids_match_exactly_when_colour_sets_match)
+{
+    std::vector<SightRead::Note> notes {
+        make_note(0, 0, SightRead::FIVE_FRET_YELLOW),
+        make_note(192, 0, SightRead::FIVE_FRET_BLUE),
+        make_note(384, 0, SightRead::FIVE_FRET_YELLOW)};
+    SightRead::NoteTrack track {notes,
+                                {},
+                                SightRead::TrackType::FiveFret,
+                                std::make_unique<SightRead::SongGlobalData>()};
+    PointSet points {track,
+                     {{}, SpMode::Measure},
+                     {},
+                     SqueezeSettings::default_settings(),
+                     SightRead::DrumSettings::default_settings(),
+                     ChGuitarEngine()};
+    const auto begin = points.cbegin();
+
+    BOOST_CHECK_EQUAL(points.colour_set_id(begin),
+                      points.colour_set_id(begin + 2));
+    BOOST_CHECK_NE(points.colour_set_id(begin),
+                   points.colour_set_id(begin + 1));
+}
+
 BOOST_AUTO_TEST_CASE(colour_set_is_correct_for_six_fret)
 {
     std::vector<SightRead::Note> notes {
@@ -1241,6 +1291,31 @@ BOOST_AUTO_TEST_CASE(fills_are_attached_to_the_nearest_ending_point)
     BOOST_TEST((begin + 3)->fill_start.has_value());
 }
 
+BOOST_AUTO_TEST_CASE(fills_out_of_order_are_attached_to_the_nearest_point)
+{
+    std::vector<SightRead::Note> notes {make_drum_note(0), make_drum_note(192),
+                                        make_drum_note(384)};
+    std::vector<SightRead::DrumFill> fills {
+        {SightRead::Tick {380}, SightRead::Tick {4}},
+        {SightRead::Tick {0}, SightRead::Tick {2}}};
+    SightRead::NoteTrack track {notes,
+                                {},
+                                SightRead::TrackType::Drums,
+                                std::make_unique<SightRead::SongGlobalData>()};
+    track.drum_fills(fills);
+    PointSet points {track,
+                     {{}, SpMode::Measure},
+                     {},
+                     SqueezeSettings::default_settings(),
+                     SightRead::DrumSettings::default_settings(),
+                     ChDrumEngine()};
+    const auto begin = points.cbegin();
+
+    BOOST_TEST(begin->fill_start.has_value());
+    BOOST_TEST(!(begin + 1)->fill_start.has_value());
+    BOOST_TEST((begin + 2)->fill_start.has_value());
+}
+
 BOOST_AUTO_TEST_CASE(fills_attach_to_later_point_in_case_of_a_tie)
 {
     std::vector<SightRead::Note> notes {make_drum_note(0), make_drum_note(192)};
@@ -16,6 +16,7 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <cstdint>
 #include <cstdlib>
 
 #include <boost/test/unit_test.hpp>
@@ -439,6 +440,38 @@ BOOST_AUTO_TEST_CASE(check_next_point_needs_to_not_lie_in_activation)
                       ActValidity::surplus_sp);
 }
 
+BOOST_AUTO_TEST_CASE(sp_margin_is_linear_in_sp_up_to_the_next_point)
+{
+    std::vector<SightRead::Note> notes {make_note(0), make_note(1536),
+                                        make_note(3072), make_note(6144)};
+    SightRead::NoteTrack note_track {
+        notes,
+        {},
+        SightRead::TrackType::FiveFret,
+        std::make_shared<SightRead::SongGlobalData>()};
+    ProcessedSong track {note_track,
+                         {{}, SpMode::Measure},
+                         SqueezeSettings::default_settings(),
+                         SightRead::DrumSettings::default_settings(),
+                         ChGuitarEngine(),
+                         {},
+                         {}};
+    const auto& points = track.points();
+    ActivationCandidate candidate {points.cbegin(),
+                                   points.cbegin() + 1,
+                                   {SightRead::Beat(0.0), SpMeasure(0.0)},
+                                   {0.5, 0.5}};
+    const auto valid_result = track.is_candidate_valid(candidate);
+    candidate.sp_bar = {0.6, 0.6};
+    const auto surplus_result = track.is_candidate_valid(candidate);
+
+    BOOST_CHECK_EQUAL(valid_result.validity, ActValidity::success);
+    BOOST_CHECK_GT(valid_result.sp_margin, 0.0);
+    BOOST_CHECK_LT(surplus_result.sp_margin, 0.0);
+    BOOST_CHECK_CLOSE(valid_result.sp_margin - surplus_result.sp_margin, 0.1,
+                      0.0001);
+}
+
 BOOST_AUTO_TEST_CASE(check_intermediate_sp_is_accounted_for)
 {
     std::vector<SightRead::Note> notes {make_note(0), make_note(1536),
@@ -1421,8 +1454,57 @@ BOOST_AUTO_TEST_CASE(adjusted_hit_window_functions_return_correct_values)
         0.0001);
 }
 
+BOOST_AUTO_TEST_CASE(adjusted_hit_windows_of_hold_points_are_the_point)
+{
+    std::vector<SightRead::Note> notes {make_note(0, 192)};
+    SightRead::NoteTrack note_track {
+        notes,
+        {},
+        SightRead::TrackType::FiveFret,
+        std::make_shared<SightRead::SongGlobalData>()};
+    ProcessedSong track {note_track,
+                         {{}, SpMode::Measure},
+                         SqueezeSettings::default_settings(),
+                         SightRead::DrumSettings::default_settings(),
+                         ChGuitarEngine(),
+                         {},
+                         {}};
+    const auto hold_point = std::next(track.points().cbegin());
+
+    BOOST_CHECK_EQUAL(track.adjusted_hit_window_start(hold_point, 0.5),
+                      hold_point->position);
+    BOOST_CHECK_EQUAL(track.adjusted_hit_window_end(hold_point, 0.5),
+                      hold_point->position);
+}
+
 BOOST_AUTO_TEST_SUITE(video_lag_is_taken_account_of)
 
+BOOST_AUTO_TEST_CASE(adjusted_hit_windows_include_video_lag)
+{
+    std::vector<SightRead::Note> notes {make_note(0)};
+    SightRead::NoteTrack note_track {
+        notes,
+        {},
+        SightRead::TrackType::FiveFret,
+        std::make_shared<SightRead::SongGlobalData>()};
+    ProcessedSong track {note_track,
+                         {{}, SpMode::Measure},
+                         {1.0, 1.0, SightRead::Second {0.0},
+                          SightRead::Second {0.1}, SightRead::Second {0.0}},
+                         SightRead::DrumSettings::default_settings(),
+                         ChGuitarEngine(),
+                         {},
+                         {}};
+    const auto& points = track.points();
+
+    BOOST_CHECK_CLOSE(
+        track.adjusted_hit_window_start(points.cbegin(), 0.5).beat.value(),
+        0.13, 0.0001);
+    BOOST_CHECK_CLOSE(
+        track.adjusted_hit_window_end(points.cbegin(), 0.5).beat.value(), 0.27,
+        0.0001);
+}
+
 BOOST_AUTO_TEST_CASE(effect_on_whammy_is_taken_account_of)
 {
     std::vector<SightRead::Note> notes {make_note(192), make_note(384, 192),
@@ -2068,3 +2150,194 @@ BOOST_AUTO_TEST_CASE(average_multiplier_is_ignored_with_rb)
 }
 
 BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(add_to_fingerprint_works_correctly)
+
+BOOST_AUTO_TEST_CASE(only_songs_that_differ_have_different_fingerprints)
+{
+    std::vector<SightRead::Note> notes {make_note(0), make_note(192)};
+    SightRead::NoteTrack note_track {
+        notes, {}, SightRead::TrackType::FiveFret,
+        std::make_shared<SightRead::SongGlobalData>()};
+    ProcessedSong track {note_track,
+                         {{}, SpMode::Measure},
+                         SqueezeSettings::default_settings(),
+                         SightRead::DrumSettings::default_settings(),
+                         ChGuitarEngine(),
+                         {},
+                         {}};
+    ProcessedSong same_track {note_track,
+                              {{}, SpMode::Measure},
+                              SqueezeSettings::default_settings(),
+                              SightRead::DrumSettings::default_settings(),
+                              ChGuitarEngine(),
+                              {},
+                              {}};
+    SightRead::TempoMap tempo_map {{{SightRead::Tick {0}, 3, 4}}, {}, {}, 192};
+    ProcessedSong three_four_track {note_track,
+                                    {tempo_map, SpMode::Measure},
+                                    SqueezeSettings::default_settings(),
+                                    SightRead::DrumSettings::default_settings(),
+                                    ChGuitarEngine(),
+                                    {},
+                                    {}};
+    Fingerprint fingerprint;
+    Fingerprint same_fingerprint;
+    Fingerprint three_four_fingerprint;
+    track.add_to_fingerprint(fingerprint);
+    same_track.add_to_fingerprint(same_fingerprint);
+    three_four_track.add_to_fingerprint(three_four_fingerprint);
+
+    BOOST_CHECK_EQUAL(fingerprint.value(), same_fingerprint.value());
+    BOOST_CHECK_NE(fingerprint.value(), three_four_fingerprint.value());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(common_suffix_length_works_correctly)
+
+BOOST_AUTO_TEST_CASE(identical_songs_share_all_but_the_first_point)
+{
+    std::vector<SightRead::Note> notes {make_note(0), make_note(192),
+                                        make_note(384), make_note(576)};
+    SightRead::NoteTrack note_track {
+        notes,
+        {},
+        SightRead::TrackType::FiveFret,
+        std::make_shared<SightRead::SongGlobalData>()};
+    ProcessedSong track {note_track,
+                         {{}, SpMode::Measure},
+                         SqueezeSettings::default_settings(),
+                         SightRead::DrumSettings::default_settings(),
+                         ChGuitarEngine(),
+                         {},
+                         {}};
+    ProcessedSong other_track {note_track,
+                               {{}, SpMode::Measure},
+                               SqueezeSettings::default_settings(),
+                               SightRead::DrumSettings::default_settings(),
+                               ChGuitarEngine(),
+                               {},
+                               {}};
+
+    BOOST_CHECK_EQUAL(track.common_suffix_length(other_track), 3U);
+}
+
+BOOST_AUTO_TEST_CASE(points_after_an_edit_are_shared)
+{
+    std::vector<SightRead::Note> notes {make_note(0), make_note(192),
+                                        make_note(384), make_note(576),
+                                        make_note(768)};
+    std::vector<SightRead::Note> edited_notes {
+        make_note(0),   make_note(96),  make_note(192),
+        make_note(384), make_note(576), make_note(768)};
+    SightRead::NoteTrack note_track {
+        notes,
+        {},
+        SightRead::TrackType::FiveFret,
+        std::make_shared<SightRead::SongGlobalData>()};
+    SightRead::NoteTrack edited_note_track {
+        edited_notes,
+        {},
+        SightRead::TrackType::FiveFret,
+        std::make_shared<SightRead::SongGlobalData>()};
+    ProcessedSong track {note_track,
+                         {{}, SpMode::Measure},
+                         SqueezeSettings::default_settings(),
+                         SightRead::DrumSettings::default_settings(),
+                         ChGuitarEngine(),
+                         {},
+                         {}};
+    ProcessedSong edited_track {edited_note_track,
+                                {{}, SpMode::Measure},
+                                SqueezeSettings::default_settings(),
+                                SightRead::DrumSettings::default_settings(),
+                                ChGuitarEngine(),
+                                {},
+                                {}};
+
+    BOOST_CHECK_EQUAL(edited_track.common_suffix_length(track), 3U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+namespace {
+// Sweeps every end from every point with a full bar, as the optimiser would
+// with no limits, and checks no activation ends at or after the limit.
+void check_no_activation_ends_past_the_limits(const ProcessedSong& track)
+{
+    const auto& points = track.points();
+    const auto limits = track.act_end_limits();
+    const auto index_of = [&](PointPtr point) {
+        return static_cast<std::uint32_t>(
+            std::distance(points.cbegin(), point));
+    };
+
+    BOOST_REQUIRE_EQUAL(limits.size(), index_of(points.cend()));
+    BOOST_CHECK_LT(limits.front(), index_of(points.cend()));
+    for (auto p = points.cbegin(); p < points.cend(); ++p) {
+        const auto limit = limits[index_of(p)];
+        const auto starting_pos = p == points.cbegin()
+            ? p->hit_window_start
+            : std::prev(p)->hit_window_start;
+        for (auto q = p; q < points.cend(); ++q) {
+            const auto validity
+                = track.is_candidate_valid({p, q, starting_pos, {1.0, 1.0}})
+                      .validity;
+            if (validity != ActValidity::insufficient_sp) {
+                BOOST_CHECK_LT(index_of(q), limit);
+            }
+        }
+    }
+}
+
+// Phrases are far enough apart that activations from the early points cannot
+// reach the end of the song.
+SightRead::NoteTrack sustain_and_phrase_note_track()
+{
+    std::vector<SightRead::Note> notes;
+    std::vector<SightRead::StarPower> phrases;
+    for (auto i = 0; i < 60; ++i) {
+        const auto length = i % 4 == 0 ? 192 : 0;
+        notes.push_back(make_note(i * 384, length));
+        if (i % 16 == 0) {
+            phrases.push_back(
+                {SightRead::Tick {i * 384}, SightRead::Tick {length + 1}});
+        }
+    }
+    return {notes, phrases, SightRead::TrackType::FiveFret,
+            std::make_shared<SightRead::SongGlobalData>()};
+}
+}
+
+BOOST_AUTO_TEST_SUITE(act_end_limits_works_correctly)
+
+BOOST_AUTO_TEST_CASE(limits_match_an_unbounded_sweep_with_overlap)
+{
+    const auto note_track = sustain_and_phrase_note_track();
+    ProcessedSong track {note_track,
+                         {{}, SpMode::Measure},
+                         SqueezeSettings::default_settings(),
+                         SightRead::DrumSettings::default_settings(),
+                         ChGuitarEngine(),
+                         {},
+                         {}};
+
+    check_no_activation_ends_past_the_limits(track);
+}
+
+BOOST_AUTO_TEST_CASE(limits_match_an_unbounded_sweep_without_overlap)
+{
+    const auto note_track = sustain_and_phrase_note_track();
+    ProcessedSong track {note_track,
+                         {{}, SpMode::Measure},
+                         SqueezeSettings::default_settings(),
+                         SightRead::DrumSettings::default_settings(),
+                         Gh1Engine(),
+                         {},
+                         {}};
+
+    check_no_activation_ends_past_the_limits(track);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -228,6 +228,37 @@ BOOST_AUTO_TEST_CASE(sp_bar_does_not_exceed_full_bar)
                       0.984375, 0.0001);
 }
 
+BOOST_AUTO_TEST_CASE(full_bar_is_respected_across_many_time_signatures)
+{
+    std::vector<SightRead::TimeSignature> time_sigs {
+        {SightRead::Tick {0}, 4, 4},    {SightRead::Tick {1536}, 2, 4},
+        {SightRead::Tick {1920}, 4, 4}, {SightRead::Tick {3456}, 2, 4},
+        {SightRead::Tick {3840}, 4, 4}};
+    SightRead::TempoMap tempo_map {time_sigs, {}, {}, 192};
+    auto global_data = std::make_shared<SightRead::SongGlobalData>();
+    global_data->tempo_map(tempo_map);
+
+    std::vector<SightRead::Note> notes {make_note(0, 5376), make_note(5568)};
+    std::vector<SightRead::StarPower> phrases {
+        {SightRead::Tick {0}, SightRead::Tick {5600}}};
+    SightRead::NoteTrack track {notes, phrases, SightRead::TrackType::FiveFret,
+                                global_data};
+    SpData sp_data {track,
+                    {{}, SpMode::Measure},
+                    {},
+                    SqueezeSettings::default_settings(),
+                    ChGuitarEngine()};
+
+    BOOST_CHECK_CLOSE(sp_data.propagate_sp_over_whammy_max(
+                          {SightRead::Beat(0.0), SpMeasure(0.0)},
+                          {SightRead::Beat(26.0), SpMeasure(7.5)}, 0.99),
+                      0.9125, 0.0001);
+    BOOST_CHECK_CLOSE(sp_data.propagate_sp_over_whammy_max(
+                          {SightRead::Beat(0.0), SpMeasure(0.0)},
+                          {SightRead::Beat(26.0), SpMeasure(7.5)}, 0.05),
+                      -1.0, 0.0001);
+}
+
 BOOST_AUTO_TEST_CASE(sustains_not_in_a_phrase_do_not_contribute_sp)
 {
     std::vector<SightRead::Note> notes {make_note(0, 1920),
@@ -312,6 +343,28 @@ BOOST_AUTO_TEST_CASE(is_in_whammy_ranges_works_correctly)
     BOOST_TEST(!sp_data.is_in_whammy_ranges(SightRead::Beat(11.0)));
 }
 
+BOOST_AUTO_TEST_CASE(is_in_whammy_ranges_works_with_sparse_sustains)
+{
+    std::vector<SightRead::Note> notes {
+        make_note(0, 192), make_note(9600, 192), make_note(19200, 192)};
+    std::vector<SightRead::StarPower> phrases {
+        {SightRead::Tick {0}, SightRead::Tick {20000}}};
+    SightRead::NoteTrack track {notes, phrases, SightRead::TrackType::FiveFret,
+                                std::make_shared<SightRead::SongGlobalData>()};
+    SpData sp_data {track,
+                    {{}, SpMode::Measure},
+                    {},
+                    SqueezeSettings::default_settings(),
+                    ChGuitarEngine()};
+
+    BOOST_TEST(sp_data.is_in_whammy_ranges(SightRead::Beat(0.5)));
+    BOOST_TEST(!sp_data.is_in_whammy_ranges(SightRead::Beat(25.0)));
+    BOOST_TEST(sp_data.is_in_whammy_ranges(SightRead::Beat(50.5)));
+    BOOST_TEST(!sp_data.is_in_whammy_ranges(SightRead::Beat(75.0)));
+    BOOST_TEST(sp_data.is_in_whammy_ranges(SightRead::Beat(100.5)));
+    BOOST_TEST(!sp_data.is_in_whammy_ranges(SightRead::Beat(101.5)));
+}
+
 BOOST_AUTO_TEST_SUITE(available_whammy_works_correctly)
 
 BOOST_AUTO_TEST_CASE(max_early_whammy)
@@ -408,6 +461,43 @@ BOOST_AUTO_TEST_CASE(three_argument_version_works_correctly)
                       0.3333333, 0.0001);
 }
 
+BOOST_AUTO_TEST_CASE(whammy_end_for_sp_inverts_available_whammy)
+{
+    std::vector<SightRead::Note> notes {make_note(0, 1920), make_note(2112),
+                                        make_note(2304, 768)};
+    std::vector<SightRead::StarPower> phrases {
+        {SightRead::Tick {0}, SightRead::Tick {3000}}};
+    SightRead::NoteTrack track {notes, phrases, SightRead::TrackType::FiveFret,
+                                std::make_shared<SightRead::SongGlobalData>()};
+    SpData sp_data {track,
+                    {{}, SpMode::Measure},
+                    {},
+                    SqueezeSettings::default_settings(),
+                    ChGuitarEngine()};
+
+    BOOST_CHECK_CLOSE(sp_data
+                          .whammy_end_for_sp(SightRead::Beat(0.0),
+                                             SightRead::Beat(16.0),
+                                             SightRead::Beat(16.0), 0.1)
+                          .value(),
+                      3.0, 0.0001);
+
+    const auto end = sp_data.whammy_end_for_sp(
+        SightRead::Beat(0.0), SightRead::Beat(16.0), SightRead::Beat(16.0),
+        0.4);
+    BOOST_TEST(end.value() > 12.0);
+    BOOST_CHECK_CLOSE(sp_data.available_whammy(SightRead::Beat(0.0), end,
+                                               SightRead::Beat(16.0)),
+                      0.4, 0.0001);
+
+    BOOST_CHECK_CLOSE(sp_data
+                          .whammy_end_for_sp(SightRead::Beat(0.0),
+                                             SightRead::Beat(16.0),
+                                             SightRead::Beat(12.0), 0.4)
+                          .value(),
+                      16.0, 0.0001);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 BOOST_AUTO_TEST_SUITE(activation_end_point_works_correctly)
@@ -516,6 +606,28 @@ BOOST_AUTO_TEST_CASE(works_when_whammy_is_present_but_accumulation_is_too_slow)
         0.0001);
 }
 
+BOOST_AUTO_TEST_CASE(sp_running_out_before_the_first_od_beat_is_detected)
+{
+    std::vector<SightRead::Note> notes {make_note(0, 768)};
+    std::vector<SightRead::StarPower> phrases {
+        {SightRead::Tick {0}, SightRead::Tick {1000}}};
+    SightRead::NoteTrack track {notes, phrases, SightRead::TrackType::FiveFret,
+                                std::make_shared<SightRead::SongGlobalData>()};
+    const std::vector<SightRead::Tick> od_beats {
+        SightRead::Tick {768}, SightRead::Tick {960}, SightRead::Tick {1152}};
+    SpData sp_data {track,
+                    {{}, SpMode::OdBeat},
+                    od_beats,
+                    SqueezeSettings::default_settings(),
+                    RbEngine()};
+    SpPosition start {SightRead::Beat(0.0), SpMeasure(0.0)};
+    SpPosition end {SightRead::Beat(4.0), SpMeasure(1.0)};
+
+    BOOST_CHECK_CLOSE(
+        sp_data.activation_end_point(start, end, 0.0625).beat.value(), 2.0,
+        0.0001);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 BOOST_AUTO_TEST_SUITE(video_lag_is_taken_account_of)